@@ -3,6 +3,19 @@
 #include <string.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <stdarg.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#else
+#include <direct.h>
+#include <process.h>
+#define getpid _getpid
+#define mkdir(path, mode) _mkdir(path)
+#endif
 
 typedef uint8_t u8;
 typedef uint16_t u16;
@@ -19,6 +32,47 @@ typedef double f64;
 
 typedef size_t usize;
 
+/* minimal threading wrappers for the -j job pool */
+#ifdef _WIN32
+#include <windows.h>
+typedef HANDLE thread_t;
+typedef CRITICAL_SECTION mutex_t;
+#define THREAD_RESULT DWORD WINAPI
+
+s32 thread_start(thread_t* thread, LPTHREAD_START_ROUTINE function, void* data) {
+	*thread = CreateThread(NULL, 0, function, data, 0, NULL);
+	return *thread != NULL;
+}
+
+void thread_join(thread_t thread) {
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+}
+
+void mutex_init(mutex_t* mutex) { InitializeCriticalSection(mutex); }
+void mutex_destroy(mutex_t* mutex) { DeleteCriticalSection(mutex); }
+void mutex_lock(mutex_t* mutex) { EnterCriticalSection(mutex); }
+void mutex_unlock(mutex_t* mutex) { LeaveCriticalSection(mutex); }
+#else
+#include <pthread.h>
+typedef pthread_t thread_t;
+typedef pthread_mutex_t mutex_t;
+#define THREAD_RESULT void*
+
+s32 thread_start(thread_t* thread, void* (*function)(void*), void* data) {
+	return pthread_create(thread, NULL, function, data) == 0;
+}
+
+void thread_join(thread_t thread) {
+	pthread_join(thread, NULL);
+}
+
+void mutex_init(mutex_t* mutex) { pthread_mutex_init(mutex, NULL); }
+void mutex_destroy(mutex_t* mutex) { pthread_mutex_destroy(mutex); }
+void mutex_lock(mutex_t* mutex) { pthread_mutex_lock(mutex); }
+void mutex_unlock(mutex_t* mutex) { pthread_mutex_unlock(mutex); }
+#endif
+
 typedef enum {
 	OPERAND_TYPE_NONE,
 	OPERAND_TYPE_REGISTER,
@@ -54,7 +108,6 @@ instruction_type_info_t instruction_types[INSTRUCTION_TYPE_COUNT] = {
 
 typedef struct {
 	char* name;
-	usize hash;
 	instruction_type_t type;
 	u8 operand_count;
 	u8 opcode;
@@ -102,7 +155,6 @@ typedef enum {
 
 typedef struct {
 	char* name;
-	usize hash;
 	protection_t protection;
 	u8 id;
 } reg_t;
@@ -135,76 +187,161 @@ reg_t registers[] = {
 	{.name = "sys7", .protection = PROTECTION_SYSTEM_MODE, .id = 0xF7 },
 };
 
+/* generated by assembler/tools/perfect_hash.c, slot values are index + 1 and 0 is empty */
+#define INSTRUCTION_HASH_MULTIPLIER 5768
+#define INSTRUCTION_HASH_BITS 6
+u8 instruction_slots[1 << INSTRUCTION_HASH_BITS] = {
+	12, 0, 0, 0, 0, 7, 0, 31, 25, 22, 0, 0, 0, 18, 0, 28,
+	0, 0, 21, 13, 19, 0, 10, 0, 20, 26, 27, 0, 11, 15, 5, 29,
+	0, 24, 0, 32, 8, 0, 0, 2, 6, 17, 0, 0, 0, 0, 14, 0,
+	0, 0, 23, 0, 9, 0, 0, 0, 0, 4, 30, 3, 0, 1, 16, 0,
+};
+#define REGISTER_HASH_MULTIPLIER 8200
+#define REGISTER_HASH_BITS 5
+u8 register_slots[1 << REGISTER_HASH_BITS] = {
+	0, 5, 23, 19, 1, 13, 0, 0, 6, 0, 22, 18, 14, 2, 9, 0,
+	0, 25, 21, 7, 15, 11, 3, 10, 17, 8, 24, 20, 16, 12, 4, 0,
+};
+
 typedef struct {
 	char* start;
 	usize length;
 } word_t;
 
+typedef struct {
+	u8* buffer;
+	usize size;
+	usize capacity;
+	s32 advance_only;
+} codegen_buffer_t;
+
+usize write_buffer(void* src, usize size, usize count, codegen_buffer_t* buffer) {
+	u8* source = (u8*) src;
+	if (buffer->size + (size * count) > buffer->capacity) {
+		usize new_capacity = buffer->capacity * 2;
+		if (new_capacity < buffer->size + (size * count)) {
+			new_capacity = buffer->size + (size * count);
+		}
+
+		void* p = realloc(buffer->buffer, new_capacity);
+		if (p == NULL) {
+			printf("Failed to allocate memory\n");
+			return 0;
+		}
+
+		buffer->buffer = (u8*) p;
+		buffer->capacity = new_capacity;
+	}
+
+	if (!buffer->advance_only) {
+		memcpy(buffer->buffer + buffer->size, source, size * count);
+	}
+	buffer->size += size * count;
+	return count;
+}
+
+/* grows an array by doubling so appending stays amortized O(1) */
+s32 reserve_array(void** data, usize* capacity, usize count, usize element_size) {
+	if (count <= *capacity) {
+		return 1;
+	}
+
+	usize new_capacity = (*capacity == 0) ? 16 : *capacity * 2;
+	while (new_capacity < count) {
+		new_capacity *= 2;
+	}
+
+	void* p = realloc(*data, new_capacity * element_size);
+	if (p == NULL) {
+		printf("Failed to allocate memory\n");
+		return 0;
+	}
+
+	*data = p;
+	*capacity = new_capacity;
+	return 1;
+}
+
+/* a 32-bit label operand, patched once every label is known */
+typedef struct {
+	word_t name;
+	u32 offset; /* within the section's bytes */
+	u32 line;
+	usize label; /* resolved by evaluate_labels */
+} fixup_t;
+
 typedef struct {
 	word_t name;
 	usize hash;
 	s32 is_defined;
+	u32 address; /* where the section starts in the default layout, labels are assembled against it */
+
+	codegen_buffer_t bytes; /* encoded instructions and data, in source order */
+	fixup_t* fixups;
+	usize fixup_count;
+	usize fixup_capacity;
 } section_t;
 
+#define SECTION_UNDEFINED ((usize) -1)
+
 typedef struct {
 	word_t name;
 	usize hash;
 	u32 address;
-	usize section;
+	usize section; /* SECTION_UNDEFINED for symbols another object has to define */
+	s32 is_global;
 } label_t;
 
-typedef struct {
-	word_t word;
-	union {
-		reg_t* reg;
-		u32 immediate;
-		u8 imm8;
-		label_t* label;
-	};
-	s32 is_label;
-} operand_t;
-
 section_t text_section = { .name = {.start = ".text", .length = 5 }, .hash = 0, .is_defined = 0 };
 
-typedef enum {
-	DEFINE_TYPE_NONE,
-	DEFINE_TYPE_8,
-	DEFINE_TYPE_16,
-	DEFINE_TYPE_32,
-	DEFINE_TYPE_64,
-} define_type_t;
-
+/* open addressing over label indices, keyed on the full name; the hash only picks the starting slot */
 typedef struct {
-	union {
-		instruction_t* instruction;
-		u8 def8;
-		u16 def16;
-		u32 def32;
-		u64 def64;
-	};
-	define_type_t define_type;
-
-	operand_t operands[3];
-	u8 current_count;
-	u32 address;
-	usize section;
-} line_t;
+	usize* slots; /* label index + 1, 0 means empty */
+	usize capacity; /* power of two */
+	usize count;
+} symbol_table_t;
 
 typedef struct {
-	line_t* lines;
-	usize line_count;
 	u32 current_address;
 	usize current_section;
 
+	/* the last instruction seen, its operands are encoded as they arrive */
+	instruction_t* pending;
+	u8 pending_count;
+
 	label_t* labels;
 	usize label_count;
+	usize label_capacity;
+	symbol_table_t symbols;
+
+	/* names given to .global, applied once every label is known */
+	word_t* globals;
+	usize global_count;
+	usize global_capacity;
+	s32 expect_global;
 
 	section_t* sections;
 	usize section_count;
+	usize section_capacity;
 	usize private_section_count;
+
+	/* where the token being processed came from, every diagnostic starts with it */
+	const char* file;
+	u32 line;
+	u32 column;
 } assembler_t;
 
-char* word_cstring(word_t* word);
+/* one printf per diagnostic, so messages from jobs on other threads never land in the middle of it */
+void report(assembler_t* assembler, const char* format, ...) {
+	char message[512];
+	va_list args;
+	va_start(args, format);
+	vsnprintf(message, sizeof(message), format, args);
+	va_end(args);
+
+	printf("%s:%u:%u: %s\n", assembler->file, assembler->line, assembler->column, message);
+}
+
 usize hash_string(char* string) {
 	usize hash = 0;
 	while (*string != '\0') {
@@ -224,25 +361,238 @@ usize hash_word(word_t* word) {
 	return hash;
 }
 
-s32 retrieve_word(char* buffer, usize size, word_t* word) {
-	if (buffer[0] == '\0') {
+s32 word_equals(word_t* a, word_t* b) {
+	return a->length == b->length && memcmp(a->start, b->start, a->length) == 0;
+}
+
+/* returns the slot holding the label or the empty slot where it would be inserted */
+usize* symbol_slot(symbol_table_t* table, label_t* labels, word_t* name, usize hash) {
+	usize mask = table->capacity - 1;
+	usize i = hash & mask;
+	while (table->slots[i] != 0) {
+		label_t* label = &labels[table->slots[i] - 1];
+		if (label->hash == hash && word_equals(&label->name, name)) {
+			break;
+		}
+
+		i = (i + 1) & mask;
+	}
+
+	return &table->slots[i];
+}
+
+label_t* symbol_find(symbol_table_t* table, label_t* labels, word_t* name) {
+	if (table->count == 0) {
+		return NULL;
+	}
+
+	usize index = *symbol_slot(table, labels, name, hash_word(name));
+	return (index == 0) ? NULL : &labels[index - 1];
+}
+
+s32 symbol_grow(symbol_table_t* table, label_t* labels) {
+	usize capacity = (table->capacity == 0) ? 64 : table->capacity * 2;
+	usize* slots = (usize*) calloc(capacity, sizeof(usize));
+	if (slots == NULL) {
+		printf("Failed to allocate memory\n");
+		return 0;
+	}
+
+	usize* old_slots = table->slots;
+	usize old_capacity = table->capacity;
+	table->slots = slots;
+	table->capacity = capacity;
+	for (usize i = 0; i < old_capacity; ++i) {
+		if (old_slots[i] != 0) {
+			label_t* label = &labels[old_slots[i] - 1];
+			*symbol_slot(table, labels, &label->name, label->hash) = old_slots[i];
+		}
+	}
+
+	free(old_slots);
+	return 1;
+}
+
+typedef struct {
+	word_t word;
+	u32 line;
+	u32 column;
+} token_t;
+
+typedef struct {
+	char* cursor;
+	char* end;
+	char* line_start;
+	u32 line;
+	const char* file;
+} lexer_t;
+
+s32 is_separator(char c) {
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == ',';
+}
+
+s32 is_comment_start(lexer_t* lexer, char* p) {
+	return p[0] == '/' && p + 1 < lexer->end && (p[1] == '/' || p[1] == '*');
+}
+
+/*
+ * one pass over the source: whitespace, commas and comments are skipped in the same loop that finds tokens,
+ * tokens point into the source so nothing is copied. returns 1 for a token, 0 at the end and -1 on error
+ */
+s32 next_token(lexer_t* lexer, token_t* token) {
+	char* p = lexer->cursor;
+	while (p < lexer->end) {
+		char c = *p;
+		if (c == '\n') {
+			++lexer->line;
+			lexer->line_start = ++p;
+		} else if (is_separator(c)) {
+			++p;
+		} else if (is_comment_start(lexer, p)) {
+			if (p[1] == '/') {
+				while (p < lexer->end && *p != '\n') {
+					++p;
+				}
+				continue;
+			}
+
+			u32 line = lexer->line;
+			u32 column = (u32) (p - lexer->line_start) + 1;
+			p += 2;
+			while (p + 1 < lexer->end && !(p[0] == '*' && p[1] == '/')) {
+				if (*p == '\n') {
+					++lexer->line;
+					lexer->line_start = p + 1;
+				}
+				++p;
+			}
+
+			if (p + 1 >= lexer->end) {
+				printf("%s:%u:%u: Unterminated comment\n", lexer->file, line, column);
+				lexer->cursor = lexer->end;
+				return -1;
+			}
+			p += 2;
+		} else {
+			break;
+		}
+	}
+
+	if (p >= lexer->end) {
+		lexer->cursor = p;
+		return 0;
+	}
+
+	token->word.start = p;
+	token->line = lexer->line;
+	token->column = (u32) (p - lexer->line_start) + 1;
+	if (*p == '\'') {
+		/* character literals may hold a separator, e.g. ' ' */
+		++p;
+		while (p < lexer->end && *p != '\'' && *p != '\n') {
+			++p;
+		}
+
+		if (p < lexer->end && *p == '\'') {
+			++p;
+		}
+	} else {
+		while (p < lexer->end && !is_separator(*p) && !is_comment_start(lexer, p)) {
+			++p;
+		}
+	}
+
+	token->word.length = (usize) (p - token->word.start);
+	lexer->cursor = p;
+	return 1;
+}
+
+/* the source stays mapped until the object is written since tokens, labels and fixups point into it */
+typedef struct {
+	char* data;
+	usize size;
+#ifdef _WIN32
+	s32 is_allocated;
+#else
+	s32 is_mapped;
+#endif
+} source_t;
+
+s32 open_source(const char* path, source_t* source) {
+	source->data = NULL;
+	source->size = 0;
+#ifdef _WIN32
+	FILE* file = fopen(path, "rb");
+	if (file == NULL) {
+		printf("Failed to open file: %s\n", path);
+		return 0;
+	}
+
+	fseek(file, 0, SEEK_END);
+	source->size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	source->data = (char*) malloc(source->size + 1);
+	if (source->data == NULL) {
+		printf("Failed to allocate memory\n");
+		fclose(file);
+		return 0;
+	}
+
+	if (fread(source->data, 1, source->size, file) != source->size) {
+		printf("Failed to read file: %s\n", path);
+		fclose(file);
+		return 0;
+	}
+
+	source->is_allocated = 1;
+	fclose(file);
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		printf("Failed to open file: %s\n", path);
 		return 0;
 	}
 
-	if (size == 0) {
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		printf("Failed to stat file: %s\n", path);
+		close(fd);
 		return 0;
 	}
 
-	usize end = 0;
-	while (end < size && buffer[end] != '\0' && buffer[end] != ' ' && buffer[end] != '\t' && buffer[end] != '\n' && buffer[end] != '\r') {
-		++end;
+	source->size = (usize) st.st_size;
+	source->is_mapped = 0;
+	if (source->size != 0) {
+		void* p = mmap(NULL, source->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p == MAP_FAILED) {
+			printf("Failed to map file: %s\n", path);
+			close(fd);
+			return 0;
+		}
+
+		madvise(p, source->size, MADV_SEQUENTIAL);
+		source->data = (char*) p;
+		source->is_mapped = 1;
 	}
 
-	word->start = buffer;
-	word->length = end;
+	close(fd);
+#endif
 	return 1;
 }
 
+void close_source(source_t* source) {
+#ifdef _WIN32
+	if (source->is_allocated) {
+		free(source->data);
+	}
+#else
+	if (source->is_mapped) {
+		munmap(source->data, source->size);
+	}
+#endif
+}
+
 s32 is_decimal(char c) {
 	return c >= '0' && c <= '9';
 }
@@ -281,88 +631,182 @@ u32 decchar_to_u32(char c) {
 	return c - '0';
 }
 
-s32 process_word(assembler_t* assembler, word_t* word) {
-	if (word->start[word->length - 1] == ':') {
-		--word->length;
-		usize hash = hash_word(word);
-		u32 offset = 0;
-		if (assembler->line_count != 0) {
-            line_t* line = &assembler->lines[assembler->line_count - 1];
-            if (line->define_type == DEFINE_TYPE_NONE) {
-                offset = instruction_types[line->instruction->type].operand_size + 1;
-            } else {
-                offset = (line->define_type == DEFINE_TYPE_64) ? 8 : (line->define_type == DEFINE_TYPE_32) ? 4 : (line->define_type == DEFINE_TYPE_16) ? 2 : 1;
-            }
-		}
-
-		label_t label = { .name = *word, .hash = hash, .address = assembler->current_address + offset, .section = assembler->current_section };
-		if (assembler->labels == NULL) {
-			assembler->labels = (label_t*) malloc(sizeof(label_t));
-			if (assembler->labels == NULL) {
-				printf("Failed to allocate memory\n");
-				return 0;
-			}
+u32 parse_immediate(word_t* word) {
+	u32(*char_to_u32)(char) = decchar_to_u32;
+	u32 radix = 10;
+	u32 start = 0;
+	if (word->length > 2 && word->start[0] == '0' && word->start[1] == 'x') {
+		char_to_u32 = hexchar_to_u32;
+		radix = 16;
+		start = 2;
+	}
 
-			assembler->label_count = 0;
-		} else {
-			void* p = realloc(assembler->labels, sizeof(label_t) * (assembler->label_count + 1));
-			if (p == NULL) {
-				printf("Failed to allocate memory\n");
-				return 0;
-			}
+	u32 value = 0;
+	for (usize i = start; i < word->length; ++i) {
+		value = (value * radix) + char_to_u32(word->start[i]);
+	}
+
+	return value;
+}
+
+/* must stay identical to perfect_hash() in tools/perfect_hash.c */
+u32 perfect_hash(word_t* word, u32 multiplier, u32 bits) {
+	u32 h = (u32) word->length;
+	h = h * multiplier + (u8) word->start[0];
+	h = h * multiplier + (u8) word->start[word->length - 1];
+	h = h * multiplier + (u8) word->start[word->length / 2];
+	return (h ^ (h >> 15)) & ((1u << bits) - 1);
+}
+
+s32 word_equals_string(word_t* word, char* string) {
+	return strncmp(word->start, string, word->length) == 0 && string[word->length] == '\0';
+}
+
+instruction_t* find_instruction(word_t* word) {
+	if (word->length == 0) {
+		return NULL;
+	}
+
+	u8 slot = instruction_slots[perfect_hash(word, INSTRUCTION_HASH_MULTIPLIER, INSTRUCTION_HASH_BITS)];
+	if (slot == 0 || !word_equals_string(word, instructions[slot - 1].name)) {
+		return NULL;
+	}
+
+	return &instructions[slot - 1];
+}
+
+reg_t* find_register(word_t* word) {
+	if (word->length == 0) {
+		return NULL;
+	}
+
+	u8 slot = register_slots[perfect_hash(word, REGISTER_HASH_MULTIPLIER, REGISTER_HASH_BITS)];
+	if (slot == 0 || !word_equals_string(word, registers[slot - 1].name)) {
+		return NULL;
+	}
+
+	return &registers[slot - 1];
+}
+
+/* labels, sections and data may only follow an instruction once all of its operands were given */
+s32 finish_instruction(assembler_t* assembler) {
+	if (assembler->pending != NULL && assembler->pending_count != assembler->pending->operand_count) {
+		report(assembler, "Instruction '%s' expects %u operands, found %u", assembler->pending->name, assembler->pending->operand_count, assembler->pending_count);
+		return 0;
+	}
+
+	assembler->pending = NULL;
+	return 1;
+}
+
+s32 emit(assembler_t* assembler, void* src, usize size) {
+	if (write_buffer(src, size, 1, &assembler->sections[assembler->current_section].bytes) != 1) {
+		return 0;
+	}
+
+	assembler->current_address += (u32) size;
+	return 1;
+}
+
+s32 add_label(assembler_t* assembler, word_t* name, u32 address, usize section) {
+	usize hash = hash_word(name);
+
+	/* keep the load factor under one half so probe sequences stay short */
+	if ((assembler->symbols.count + 1) * 2 > assembler->symbols.capacity) {
+		if (!symbol_grow(&assembler->symbols, assembler->labels)) {
+			return 0;
+		}
+	}
+
+	usize* slot = symbol_slot(&assembler->symbols, assembler->labels, name, hash);
+	if (*slot != 0) {
+		report(assembler, "Label '%.*s' defined twice", (int) name->length, name->start);
+		return 0;
+	}
+
+	if (!reserve_array((void**) &assembler->labels, &assembler->label_capacity, assembler->label_count + 1, sizeof(label_t))) {
+		return 0;
+	}
 
-			assembler->labels = (label_t*) p;
+	assembler->labels[assembler->label_count] = (label_t){ .name = *name, .hash = hash, .address = address, .section = section, .is_global = 0 };
+	assembler->label_count++;
+	*slot = assembler->label_count;
+	++assembler->symbols.count;
+	return 1;
+}
+
+s32 process_word(assembler_t* assembler, token_t* token) {
+	word_t* word = &token->word;
+	if (assembler->expect_global) {
+		if (!is_alpha(word->start[0]) || word->start[word->length - 1] == ':') {
+			report(assembler, "Expected a symbol name after .global, found '%.*s'", (int) word->length, word->start);
+			return 0;
 		}
 
-		assembler->labels[assembler->label_count] = label;
-		assembler->label_count++;
+		if (!reserve_array((void**) &assembler->globals, &assembler->global_capacity, assembler->global_count + 1, sizeof(word_t))) {
+			return 0;
+		}
+
+		assembler->globals[assembler->global_count++] = *word;
+		assembler->expect_global = 0;
 		return 1;
+	}
+
+	if (word->start[word->length - 1] == ':') {
+		if (!finish_instruction(assembler)) {
+			return 0;
+		}
+
+		--word->length;
+		return add_label(assembler, word, assembler->current_address, assembler->current_section);
 	} else if (word->start[0] == '.') {
+		if (!finish_instruction(assembler)) {
+			return 0;
+		}
+
+		if (word_equals_string(word, ".global")) {
+			assembler->expect_global = 1;
+			return 1;
+		}
+
+		/* names the assembler emits itself */
 		usize hash = hash_word(word);
-		if (hash == hash_string(".shstrtab")) {
-			printf("'%s' is a reserved section name\n", word_cstring(word));
+		if (word_equals_string(word, ".shstrtab") || word_equals_string(word, ".symtab") || word_equals_string(word, ".strtab") || (word->length >= 4 && strncmp(word->start, ".rel", 4) == 0)) {
+			report(assembler, "'%.*s' is a reserved section name", (int) word->length, word->start);
 			return 0;
 		}
 
 		for (usize i = 0; i < assembler->section_count; ++i) {
-			if (assembler->sections[i].hash == hash) {
+			if (assembler->sections[i].hash == hash && word_equals(&assembler->sections[i].name, word)) {
 				if (assembler->sections[i].is_defined) {
-					printf("'%s' defined twice. Separated section definitions are currently unsupported", word_cstring(word));
+					report(assembler, "'%.*s' defined twice. Separated section definitions are currently unsupported", (int) word->length, word->start);
 					return 0;
 				}
 
 				assembler->current_section = i;
 				assembler->sections[i].is_defined = 1;
+				if (assembler->sections[i].bytes.size == 0) {
+					assembler->sections[i].address = assembler->current_address;
+				}
 				return 1;
 			}
 		}
 
-		section_t section = { .name = *word, .hash = hash, .is_defined = 1 };
-		if (assembler->sections == NULL) {
-			assembler->sections = (section_t*) malloc(sizeof(section_t));
-			if (assembler->sections == NULL) {
-				printf("Failed to allocate memory\n");
-				return 0;
-			}
-
-			assembler->section_count = 0;
-		} else {
-			void* p = realloc(assembler->sections, sizeof(section_t) * (assembler->section_count + 1));
-			if (p == NULL) {
-				printf("Failed to allocate memory\n");
-				return 0;
-			}
-
-			assembler->sections = (section_t*) p;
+		if (!reserve_array((void**) &assembler->sections, &assembler->section_capacity, assembler->section_count + 1, sizeof(section_t))) {
+			return 0;
 		}
 
-		assembler->sections[assembler->section_count] = section;
+		assembler->sections[assembler->section_count] = (section_t){ .name = *word, .hash = hash, .is_defined = 1, .address = assembler->current_address };
 		assembler->current_section = assembler->section_count;
 		++assembler->section_count;
 		return 1;
 	} else if (word->start[0] == '=') {
 		if (word->length < 2) {
-			printf("Unexpected sequence '%s'\n", word_cstring(word));
+			report(assembler, "Unexpected sequence '%.*s'", (int) word->length, word->start);
+			return 0;
+		}
+
+		if (!finish_instruction(assembler)) {
 			return 0;
 		}
 
@@ -380,251 +824,145 @@ s32 process_word(assembler_t* assembler, word_t* word) {
 			value = (value * radix) + char_to_u32(word->start[i]);
 		}
 
+		/* the width comes from the digit count, or the value for decimals */
 		usize len = word->length - start;
-		line_t line = { .define_type = DEFINE_TYPE_32, .def64 = value, .current_count = 0, .address = assembler->current_address, .section = assembler->current_section };
+		usize size = 4;
 		if (radix == 10) {
 			if (len > 10 || value > 0xFFFFFFFF) {
 				if (len > 20) {
-					printf("Warning: '%s': larger than 64-bits, the value will be truncated", word_cstring(word));
+					report(assembler, "Warning: '%.*s': larger than 64-bits, the value will be truncated", (int) word->length, word->start);
 				}
-				line.define_type = DEFINE_TYPE_64;
-				assembler->current_address += 8;
+				size = 8;
 			} else if (len > 5 || value > 0xFFFF) {
-				line.define_type = DEFINE_TYPE_32;
-				assembler->current_address += 4;
+				size = 4;
 			} else if (len > 3 || value > 0xFF) {
-				line.define_type = DEFINE_TYPE_16;
-				assembler->current_address += 2;
+				size = 2;
 			} else {
-				line.define_type = DEFINE_TYPE_8;
-				++assembler->current_address;
+				size = 1;
 			}
 		} else if (radix == 16) {
 			if (len > 8) {
 				if (len > 16) {
-					printf("Warning: '%s': larger than 64-bits, the value will be truncated", word_cstring(word));
+					report(assembler, "Warning: '%.*s': larger than 64-bits, the value will be truncated", (int) word->length, word->start);
 				}
-				line.define_type = DEFINE_TYPE_64;
-				assembler->current_address += 8;
+				size = 8;
 			} else if (len > 4) {
-				line.define_type = DEFINE_TYPE_32;
-				assembler->current_address += 4;
+				size = 4;
 			} else if (len > 2) {
-				line.define_type = DEFINE_TYPE_16;
-				assembler->current_address += 2;
+				size = 2;
 			} else {
-				line.define_type = DEFINE_TYPE_8;
-				++assembler->current_address;
+				size = 1;
 			}
 		}
 
-		if (assembler->lines == NULL) {
-			assembler->lines = (line_t*) malloc(sizeof(line_t));
-			if (assembler->lines == NULL) {
-				printf("Failed to allocate memory\n");
-				return 0;
-			}
-
-			assembler->line_count = 0;
-		} else {
-			void* p = realloc(assembler->lines, sizeof(line_t) * (assembler->line_count + 1));
-			if (p == NULL) {
-				printf("Failed to allocate memory\n");
-				return 0;
-			}
+		u8 def8 = (u8) value;
+		u16 def16 = (u16) value;
+		u32 def32 = (u32) value;
+		void* src = (size == 8) ? (void*) &value : (size == 4) ? (void*) &def32 : (size == 2) ? (void*) &def16 : (void*) &def8;
+		return emit(assembler, src, size);
+	}
 
-			assembler->lines = (line_t*) p;
+	instruction_t* mnemonic = find_instruction(word);
+	if (mnemonic != NULL) {
+		if (!finish_instruction(assembler)) {
+			return 0;
 		}
 
-		assembler->lines[assembler->line_count] = line;
-		++assembler->line_count;
-		return 1;
+		assembler->pending = mnemonic;
+		assembler->pending_count = 0;
+		return emit(assembler, &mnemonic->opcode, 1);
 	}
 
-	line_t line = (line_t){ .define_type = DEFINE_TYPE_NONE, .instruction = NULL, .current_count = 0, .address = assembler->current_address, };
-	if (assembler->line_count != 0) {
-		line_t* l = &assembler->lines[assembler->line_count - 1];
-		if (l->define_type == DEFINE_TYPE_NONE) {
-			line = *l;
-		}
+	instruction_t* instruction = assembler->pending;
+	if (instruction == NULL) {
+		report(assembler, "No instruction found prior to sequence '%.*s'", (int) word->length, word->start);
+		return 0;
 	}
 
-	usize hash = hash_word(word);
-	for (u16 i = 0; i < sizeof(instructions) / sizeof(instruction_t); ++i) {
-		if (instructions[i].hash == hash) {
-			line.section = assembler->current_section;
-			if (line.define_type == DEFINE_TYPE_NONE && line.instruction != NULL && line.current_count == line.instruction->operand_count) {
-				assembler->current_address += instruction_types[line.instruction->type].operand_size + 1;
-				line.instruction = &instructions[i];
-				line.address = assembler->current_address;
-				line.current_count = 0;
-
-				void* p = realloc(assembler->lines, sizeof(line_t) * (assembler->line_count + 1));
-				if (p == NULL) {
-					printf("Failed to allocate memory\n");
-					return 0;
-				}
+	if (assembler->pending_count >= instruction->operand_count) {
+		report(assembler, "Instruction '%s' already has %u operands; unexpected sequence '%.*s'", instruction->name, instruction->operand_count, (int) word->length, word->start);
+		return 0;
+	}
 
-				assembler->lines = (line_t*) p;
-				assembler->lines[assembler->line_count] = line;
-				++assembler->line_count;
-				return 1;
+	operand_type_t type = instruction_types[instruction->type].operand_types[assembler->pending_count];
+	++assembler->pending_count;
+	switch (type) {
+		case OPERAND_TYPE_NONE:
+			report(assembler, "Instruction '%s' does not take any operands; unexpected sequence '%.*s'", instruction->name, (int) word->length, word->start);
+			return 0;
+		case OPERAND_TYPE_REGISTER: {
+			reg_t* reg = find_register(word);
+			if (reg == NULL) {
+				report(assembler, "No register found for sequence '%.*s'", (int) word->length, word->start);
+				return 0;
 			}
 
-			line.instruction = &instructions[i];
-			if (assembler->lines == NULL) {
-				assembler->lines = (line_t*) malloc(sizeof(line_t));
-				if (assembler->lines == NULL) {
-					printf("Failed to allocate memory\n");
+			return emit(assembler, &reg->id, 1);
+		}
+		case OPERAND_TYPE_IMMEDIATE: {
+			u32 immediate = 0;
+			if (is_alpha(word->start[0])) {
+				section_t* section = &assembler->sections[assembler->current_section];
+				if (!reserve_array((void**) &section->fixups, &section->fixup_capacity, section->fixup_count + 1, sizeof(fixup_t))) {
 					return 0;
 				}
 
-				assembler->line_count = 0;
+				section->fixups[section->fixup_count] = (fixup_t){ .name = *word, .offset = (u32) section->bytes.size, .line = token->line };
+				++section->fixup_count;
+			} else if (instruction->type == INSTRUCTION_TYPE_1_REGISTER_1_IMMEDIATE && word->start[0] == '\'' && word->start[word->length - 1] == '\'' && word->length == 3) {
+				immediate = word->start[1];
 			} else {
-				void* p = realloc(assembler->lines, sizeof(line_t) * (assembler->line_count + 1));
-				if (p == NULL) {
-					printf("Failed to allocate memory\n");
-					return 0;
-				}
-
-				assembler->lines = (line_t*) p;
+				immediate = parse_immediate(word);
 			}
 
-			assembler->lines[assembler->line_count] = line;
-			++assembler->line_count;
-			return 1;
+			return emit(assembler, &immediate, 4);
+		}
+		case OPERAND_TYPE_IMM8: {
+			u8 imm8 = (u8) parse_immediate(word);
+			return emit(assembler, &imm8, 1);
 		}
 	}
 
-	if (line.instruction == NULL) {
-		printf("No instruction found prior to sequence '%s'\n", word_cstring(word));
-		return 0;
-	}
+	return 1;
+}
 
-	if (line.current_count >= line.instruction->operand_count) {
-        printf("Instruction '%s' already has %u operands; unexpected sequence '%s' (line %zu)\n", line.instruction->name, line.instruction->operand_count, word_cstring(word), assembler->line_count);
+/*
+ * patches every label operand now that all labels are known. names nobody defined become undefined
+ * global symbols for the linker to resolve, the operand keeps 0 until then
+ */
+s32 evaluate_labels(assembler_t* assembler) {
+	if (assembler->expect_global) {
+		report(assembler, "Expected a symbol name after .global");
 		return 0;
 	}
 
-	operand_t operand = { .word = *word };
-	switch (line.instruction->type) {
-		case INSTRUCTION_TYPE_NO_OPERAND:
-			printf("Instruction '%s' does not take any operands; unexpected sequence '%s'\n", line.instruction->name, word_cstring(word));
-			return 0;
-		case INSTRUCTION_TYPE_1_REGISTER:
-		case INSTRUCTION_TYPE_2_REGISTER:
-		case INSTRUCTION_TYPE_3_REGISTER:
-			for (u16 i = 0; i < sizeof(registers) / sizeof(reg_t); ++i) {
-				if (registers[i].hash == hash) {
-					operand.reg = &registers[i];
-					break;
-				}
-			}
-
-			if (operand.reg == NULL) {
-				printf("No register found for sequence '%s'\n", word_cstring(word));
+	for (usize i = 0; i < assembler->global_count; ++i) {
+		label_t* label = symbol_find(&assembler->symbols, assembler->labels, &assembler->globals[i]);
+		if (label == NULL) {
+			if (!add_label(assembler, &assembler->globals[i], 0, SECTION_UNDEFINED)) {
 				return 0;
 			}
-			break;
-		case INSTRUCTION_TYPE_1_REGISTER_1_IMMEDIATE:
-			if (line.current_count == 0) {
-				for (u16 i = 0; i < sizeof(registers) / sizeof(reg_t); ++i) {
-					if (registers[i].hash == hash) {
-						operand.reg = &registers[i];
-						break;
-					}
-				}
-
-				if (operand.reg == NULL) {
-					printf("No register found for sequence '%s'\n", word_cstring(word));
-					return 0;
-				}
-			} else {
-				if (is_alpha(word->start[0])) {
-					operand.is_label = 1;
-				} else if (word->start[0] == '\'' && word->start[word->length - 1] == '\'' && word->length == 3) {
-                    operand.immediate = word->start[1];
-                } else {
-					u32(*char_to_u32)(char) = decchar_to_u32;
-					u32 radix = 10;
-					u32 start = 0;
-					if (word->length > 2 && word->start[0] == '0' && word->start[1] == 'x') {
-						char_to_u32 = hexchar_to_u32;
-						radix = 16;
-						start = 2;
-					}
-
-					operand.immediate = 0;
-					for (usize i = start; i < word->length; ++i) {
-						operand.immediate = (operand.immediate * radix) + char_to_u32(word->start[i]);
-					}
-				}
-			}
-			break;
-        case INSTRUCTION_TYPE_1_IMMEDIATE:
-            if (is_alpha(word->start[0])) {
-				operand.is_label = 1;
-			} else {
-				u32(*char_to_u32)(char) = decchar_to_u32;
-				u32 radix = 10;
-				u32 start = 0;
-				if (word->length > 2 && word->start[0] == '0' && word->start[1] == 'x') {
-					char_to_u32 = hexchar_to_u32;
-					radix = 16;
-					start = 2;
-				}
-
-				operand.immediate = 0;
-				for (usize i = start; i < word->length; ++i) {
-					operand.immediate = (operand.immediate * radix) + char_to_u32(word->start[i]);
-				}
-			}
-            break;
-		case INSTRUCTION_TYPE_SYSTEM: {
-			u32(*char_to_u32)(char) = decchar_to_u32;
-			u32 radix = 10;
-			u32 start = 0;
-			if (word->length > 2 && word->start[0] == '0' && word->start[1] == 'x') {
-				char_to_u32 = hexchar_to_u32;
-				radix = 16;
-				start = 2;
-			}
-
-			operand.imm8 = 0;
-			for (usize i = start; i < word->length; ++i) {
-				operand.imm8 = (operand.imm8 * radix) + char_to_u32(word->start[i]);
-			}
-		} break;
-	}
-
-	line.operands[line.current_count] = operand;
-	++line.current_count;
-	assembler->lines[assembler->line_count - 1] = line;
-	return 1;
-}
-
-s32 evaluate_labels(assembler_t* assembler) {
-	for (usize i = 0; i < assembler->line_count; ++i) {
-		line_t* line = &assembler->lines[i];
-		if (line->define_type != DEFINE_TYPE_NONE) {
-			continue;
+			label = &assembler->labels[assembler->label_count - 1];
 		}
 
-		for (usize j = 0; j < line->instruction->operand_count; ++j) {
-			if (line->operands[j].is_label) {
-				usize hash = hash_word(&line->operands[j].word);
-				for (usize k = 0; k < assembler->label_count; ++k) {
-					if (assembler->labels[k].hash == hash) {
-						line->operands[j].label = &assembler->labels[k];
-						break;
-					}
-				}
+		label->is_global = 1;
+	}
 
-				if (line->operands[j].label == NULL) {
-					printf("Undefined label '%s'\n", word_cstring(&line->operands[j].word));
+	for (usize i = 0; i < assembler->section_count; ++i) {
+		section_t* section = &assembler->sections[i];
+		for (usize j = 0; j < section->fixup_count; ++j) {
+			fixup_t* fixup = &section->fixups[j];
+			label_t* label = symbol_find(&assembler->symbols, assembler->labels, &fixup->name);
+			if (label == NULL) {
+				if (!add_label(assembler, &fixup->name, 0, SECTION_UNDEFINED)) {
 					return 0;
 				}
+				label = &assembler->labels[assembler->label_count - 1];
+				label->is_global = 1;
 			}
+
+			fixup->label = (usize) (label - assembler->labels);
+			memcpy(&section->bytes.buffer[fixup->offset], &label->address, 4);
 		}
 	}
 
@@ -643,7 +981,7 @@ typedef struct {
 
 typedef struct {
 	elf_ident_t ident;
-	u16 type; /* 0x02 executable */
+	u16 type; /* 0x01 relocatable */
 	u16 machine; /* 0x726B (kr32 machine) */
 	u32 version; /* 0x01 */
 	u32 entry;
@@ -684,46 +1022,26 @@ typedef struct {
 
 typedef struct {
 	u32 offset;
-	u32 info;
+	u32 info; /* symbol index << 8 | type */
 } elf_relocation_t;
 
+/* the only relocation type: the 32-bit absolute address of a symbol */
+#define R_KR32_32 0x01
+
+typedef struct {
+	u32 name_offset; /* into .strtab */
+	u32 value; /* offset within its section */
+	u32 size;
+	u8 info; /* binding << 4 | type, 0 local and 1 global */
+	u8 other;
+	u16 section_index; /* 0 when undefined */
+} elf_symbol_t;
+
 typedef struct {
 	elf_header_t header;
 	elf_program_header_t program_header;
 } elf_t;
 
-typedef struct {
-	u8* buffer;
-	usize size;
-	usize capacity;
-	s32 advance_only;
-} codegen_buffer_t;
-
-usize write_buffer(void* src, usize size, usize count, codegen_buffer_t* buffer) {
-	u8* source = (u8*) src;
-	if (buffer->size + (size * count) > buffer->capacity) {
-		usize new_capacity = buffer->capacity * 2;
-		if (new_capacity < buffer->size + (size * count)) {
-			new_capacity = buffer->size + (size * count);
-		}
-
-		void* p = realloc(buffer->buffer, new_capacity);
-		if (p == NULL) {
-			printf("Failed to allocate memory\n");
-			return 0;
-		}
-
-		buffer->buffer = (u8*) p;
-		buffer->capacity = new_capacity;
-	}
-
-	if (!buffer->advance_only) {
-		memcpy(buffer->buffer + buffer->size, source, size * count);
-	}
-	buffer->size += size * count;
-	return count;
-}
-
 s32 write_elf(codegen_buffer_t* buffer, elf_t* elf) {
 	if (write_buffer(elf->header.ident.magic, sizeof(elf->header.ident.magic), 1, buffer) != 1) {
 		printf("Failed to write magic\n");
@@ -949,7 +1267,51 @@ void hexdump(codegen_buffer_t* buffer) {
 	}
 }
 
+s32 align_buffer(codegen_buffer_t* buffer, u32* current_offset, u32 alignment) {
+	u8 zero = 0;
+	while (*current_offset % alignment != 0) {
+		if (write_buffer(&zero, 1, 1, buffer) != 1) {
+			printf("Failed to write padding\n");
+			return 0;
+		}
+		++*current_offset;
+	}
+
+	return 1;
+}
+
+char* copy_name(const char* prefix, word_t* name) {
+	usize prefix_length = strlen(prefix);
+	char* copy = (char*) malloc(prefix_length + name->length + 1);
+	if (copy == NULL) {
+		printf("Failed to allocate memory\n");
+		return NULL;
+	}
+
+	memcpy(copy, prefix, prefix_length);
+	memcpy(copy + prefix_length, name->start, name->length);
+	copy[prefix_length + name->length] = '\0';
+	return copy;
+}
+
+/*
+ * writes a relocatable object: the assembled sections, then .symtab with every label (locals first),
+ * .strtab and a .rel.<section> for each section with label operands. every R_KR32_32 relocation
+ * resolves to S + (stored word - provisional address of S), where the provisional address is the
+ * symbol's section address + its value. operands already hold the provisional address, so an object
+ * whose symbols are all defined is ready to run at the default layout without relocating
+ */
 s32 codegen_obj(assembler_t* assembler, FILE* outfp) {
+	usize rel_count = 0;
+	for (usize i = 0; i < assembler->section_count; ++i) {
+		rel_count += (assembler->sections[i].fixup_count != 0);
+	}
+
+	usize user_count = assembler->private_section_count + assembler->section_count;
+	usize symtab_index = user_count;
+	usize strtab_index = user_count + 1;
+	usize header_count = user_count + 2 + rel_count;
+
 	/* elf header */
 	elf_t elf = {
 		.header = {
@@ -963,7 +1325,7 @@ s32 codegen_obj(assembler_t* assembler, FILE* outfp) {
 				.reserved = { 0 },
 			},
 
-			.type = 0x02,
+			.type = 0x01,
 			.machine = 0x726B,
 			.version = 0x01,
 			.entry = 0x00000000,
@@ -974,7 +1336,7 @@ s32 codegen_obj(assembler_t* assembler, FILE* outfp) {
 			.phentry_size = 0x0020,
 			.phcount = 0x0001,
 			.shentry_size = 0x0028,
-			.shcount = (u32) (assembler->section_count + assembler->private_section_count),
+			.shcount = (u16) header_count,
 			.shname_index = 0x0001,
 		},
 		.program_header = {
@@ -982,70 +1344,44 @@ s32 codegen_obj(assembler_t* assembler, FILE* outfp) {
 			.offset = 0x00000054,
 			.vaddress = 0x00000000,
 			.paddress = 0x00000000,
-			.file_size = assembler->current_address + 1,
-			.memory_size = assembler->current_address + 1,
+			.file_size = assembler->current_address,
+			.memory_size = assembler->current_address,
 			.flags = 0x00000005,
 			.align = 0x00000004,
 		}
 	};
 
-	elf_section_header_t* headers = (elf_section_header_t*) malloc(sizeof(elf_section_header_t) * (assembler->section_count + assembler->private_section_count));
+	elf_section_header_t* headers = (elf_section_header_t*) calloc(header_count, sizeof(elf_section_header_t));
 	if (headers == NULL) {
 		printf("Failed to allocate memory\n");
 		return 0;
 	}
 
-	const char** section_names = (const char**) malloc(sizeof(const char*) * (assembler->section_count + assembler->private_section_count));
+	const char** section_names = (const char**) calloc(header_count, sizeof(const char*));
 	if (section_names == NULL) {
 		printf("Failed to allocate memory\n");
 		return 0;
 	}
 
 	section_names[0] = "";
-	headers[0] = (elf_section_header_t){
-		.name_offset = 0,
-		.type = 0x00,
-		.flags = 0x00,
-		.address = 0x00000000,
-		.offset = 0x00000000,
-		.size = 0x00000000,
-		.link = 0x00000000,
-		.info = 0x00000000,
-		.address_align = 0x00000000,
-		.entry_size = 0x00000000,
-	};
-
 	section_names[1] = ".shstrtab";
-	headers[1] = (elf_section_header_t){
-		.name_offset = 1,
-		.type = 0x03,
-		.flags = 0x00,
-		.address = 0x00000000,
-		.offset = 0x00000000,
-		.size = 0x00000000,
-		.link = 0x00000000,
-		.info = 0x00000000,
-		.address_align = 0x00000001,
-		.entry_size = 0x00000000,
-	};
+	headers[1].type = 0x03;
+	headers[1].address_align = 0x00000001;
 
-	for (usize i = 2; i < assembler->section_count + assembler->private_section_count; ++i) {
-		section_names[i] = malloc(assembler->sections[i - assembler->private_section_count].name.length + 1);
+	for (usize i = 2; i < user_count; ++i) {
+		section_names[i] = copy_name("", &assembler->sections[i - assembler->private_section_count].name);
 		if (section_names[i] == NULL) {
-			printf("Failed to allocate memory\n");
 			return 0;
 		}
 
-		memcpy((void*) section_names[i], (const void*) assembler->sections[i - assembler->private_section_count].name.start, assembler->sections[i - assembler->private_section_count].name.length);
-		((char*) section_names[i])[assembler->sections[i - assembler->private_section_count].name.length] = '\0';
-
-		if (strcmp(section_names[i], ".text") == 0) {
+		/* .text.name and friends split a section per function or object so k32-ld --gc-sections can drop them */
+		if (strcmp(section_names[i], ".text") == 0 || strncmp(section_names[i], ".text.", 6) == 0) {
 			headers[i].type = 0x01;
 			headers[i].flags = 0x06;
-		} else if (strcmp(section_names[i], ".data") == 0) {
+		} else if (strcmp(section_names[i], ".data") == 0 || strncmp(section_names[i], ".data.", 6) == 0) {
 			headers[i].type = 0x01;
 			headers[i].flags = 0x03;
-		} else if (strcmp(section_names[i], ".bss") == 0) {
+		} else if (strcmp(section_names[i], ".bss") == 0 || strncmp(section_names[i], ".bss.", 5) == 0) {
 			headers[i].type = 0x08;
 			headers[i].flags = 0x03;
 		} else {
@@ -1053,18 +1389,57 @@ s32 codegen_obj(assembler_t* assembler, FILE* outfp) {
 			headers[i].flags = 0x00;
 		}
 
-		headers[i].name_offset = 0x00000000;
-		headers[i].address = 0x00000000;
-		headers[i].offset = 0x00000000;
-		headers[i].size = 0x00000000;
-		headers[i].link = 0x00000000;
-		headers[i].info = 0x00000000;
 		headers[i].address_align = 0x00000004;
-		headers[i].entry_size = 0x00000000;
+	}
+
+	word_t symtab_name = { .start = ".symtab", .length = 7 };
+	word_t strtab_name = { .start = ".strtab", .length = 7 };
+	section_names[symtab_index] = copy_name("", &symtab_name);
+	section_names[strtab_index] = copy_name("", &strtab_name);
+	if (section_names[symtab_index] == NULL || section_names[strtab_index] == NULL) {
+		return 0;
+	}
+
+	headers[symtab_index] = (elf_section_header_t){ .type = 0x02, .link = (u32) strtab_index, .address_align = 0x00000004, .entry_size = sizeof(elf_symbol_t) };
+	headers[strtab_index] = (elf_section_header_t){ .type = 0x03, .address_align = 0x00000001 };
+
+	usize rel_index = strtab_index + 1;
+	for (usize i = 0; i < assembler->section_count; ++i) {
+		if (assembler->sections[i].fixup_count == 0) {
+			continue;
+		}
+
+		section_names[rel_index] = copy_name(".rel", &assembler->sections[i].name);
+		if (section_names[rel_index] == NULL) {
+			return 0;
+		}
+
+		headers[rel_index] = (elf_section_header_t){ .type = 0x09, .flags = 0x40, .link = (u32) symtab_index, .info = (u32) (i + assembler->private_section_count), .address_align = 0x00000004, .entry_size = sizeof(elf_relocation_t) };
+		++rel_index;
+	}
+
+	/* symbol 0 is the null symbol, locals have to come before globals */
+	u32* symbol_indices = (u32*) malloc(sizeof(u32) * (assembler->label_count + 1));
+	if (symbol_indices == NULL) {
+		printf("Failed to allocate memory\n");
+		return 0;
+	}
+
+	u32 symbol_count = 1;
+	for (s32 pass = 0; pass < 2; ++pass) {
+		for (usize i = 0; i < assembler->label_count; ++i) {
+			if (assembler->labels[i].is_global == pass) {
+				symbol_indices[i] = symbol_count++;
+			}
+		}
+
+		if (pass == 0) {
+			headers[symtab_index].info = symbol_count;
+		}
 	}
 
 	codegen_buffer_t buffer = {
-		.capacity = sizeof(elf_header_t) + sizeof(elf_program_header_t) + sizeof(elf_section_header_t) * (assembler->section_count + assembler->private_section_count) + 20,
+		.capacity = sizeof(elf_header_t) + sizeof(elf_program_header_t) + sizeof(elf_section_header_t) * header_count + 20,
 		.size = 0,
 		.advance_only = 0,
 	};
@@ -1083,144 +1458,109 @@ s32 codegen_obj(assembler_t* assembler, FILE* outfp) {
 	buffer.advance_only = 0;
 
 	u32 current_offset = (u32) buffer.size;
-	u32 current_sections_name_len = 1;
 	for (usize sect = 0; sect < assembler->section_count; ++sect) {
 		elf_section_header_t* header = &headers[sect + assembler->private_section_count];
+		section_t* section = &assembler->sections[sect];
 		header->offset = current_offset;
+		header->address = section->address + elf.program_header.vaddress;
+
+		if (section->bytes.size != 0 && write_buffer(section->bytes.buffer, section->bytes.size, 1, &buffer) != 1) {
+			printf("Failed to write section bytes\n");
+			return 0;
+		}
+		current_offset += (u32) section->bytes.size;
+
+		header->size = current_offset - header->offset;
+	}
 
-		current_sections_name_len += (u32) strlen(section_names[sect + 1]) + 1;
-		header->name_offset = current_sections_name_len;
-		header->address = current_offset - 0x54 + elf.program_header.vaddress;
+	/* .strtab is built alongside .symtab and written after it */
+	codegen_buffer_t strtab = { .buffer = NULL, .size = 0, .capacity = 0, .advance_only = 0 };
+	u8 zero = 0;
+	if (write_buffer(&zero, 1, 1, &strtab) != 1) {
+		return 0;
+	}
 
-		for (usize i = 0; i < assembler->line_count; ++i) {
-			line_t line = assembler->lines[i];
-			if (line.section != sect) {
+	if (!align_buffer(&buffer, &current_offset, 4)) {
+		return 0;
+	}
+
+	headers[symtab_index].offset = current_offset;
+	elf_symbol_t null_symbol = { 0 };
+	if (write_buffer(&null_symbol, sizeof(elf_symbol_t), 1, &buffer) != 1) {
+		printf("Failed to write symbol\n");
+		return 0;
+	}
+
+	for (s32 pass = 0; pass < 2; ++pass) {
+		for (usize i = 0; i < assembler->label_count; ++i) {
+			label_t* label = &assembler->labels[i];
+			if (label->is_global != pass) {
 				continue;
 			}
 
-			switch (line.define_type) {
-				case DEFINE_TYPE_8:
-					if (write_buffer(&line.def8, 1, 1, &buffer) != 1) {
-						printf("Failed to write define byte\n");
-						return 0;
-					}
-					current_offset += 1;
-					continue;
-				case DEFINE_TYPE_16:
-					if (write_buffer(&line.def16, 2, 1, &buffer) != 1) {
-						printf("Failed to write define word\n");
-						return 0;
-					}
-					current_offset += 2;
-					continue;
-				case DEFINE_TYPE_32:
-					if (write_buffer(&line.def32, 4, 1, &buffer) != 1) {
-						printf("Failed to write define dword\n");
-						return 0;
-					}
-					current_offset += 4;
-					continue;
-				case DEFINE_TYPE_64:
-					if (write_buffer(&line.def64, 8, 1, &buffer) != 1) {
-						printf("Failed to write define qword\n");
-						return 0;
-					}
-					current_offset += 8;
-					continue;
-				default:
-					break;
+			elf_symbol_t symbol = {
+				.name_offset = (u32) strtab.size,
+				.value = 0,
+				.size = 0,
+				.info = (u8) (label->is_global << 4),
+				.other = 0,
+				.section_index = 0,
+			};
+
+			if (label->section != SECTION_UNDEFINED) {
+				symbol.value = label->address - assembler->sections[label->section].address;
+				symbol.section_index = (u16) (label->section + assembler->private_section_count);
 			}
 
-			u8 opcode = line.instruction->opcode;
-			if (write_buffer(&opcode, 1, 1, &buffer) != 1) {
-				printf("Failed to write opcode\n");
+			if (write_buffer(label->name.start, label->name.length, 1, &strtab) != 1 || write_buffer(&zero, 1, 1, &strtab) != 1) {
 				return 0;
 			}
-			current_offset += 1;
-
-			switch (line.instruction->type) {
-				case INSTRUCTION_TYPE_NO_OPERAND:
-					break;
-				case INSTRUCTION_TYPE_1_REGISTER:
-					if (write_buffer(&line.operands[0].reg->id, 1, 1, &buffer) != 1) {
-						printf("Failed to write register id\n");
-						return 0;
-					}
-					current_offset += 1;
-					break;
-				case INSTRUCTION_TYPE_2_REGISTER:
-					if (write_buffer(&line.operands[0].reg->id, 1, 1, &buffer) != 1) {
-						printf("Failed to write register id\n");
-						return 0;
-					}
-					if (write_buffer(&line.operands[1].reg->id, 1, 1, &buffer) != 1) {
-						printf("Failed to write register id\n");
-						return 0;
-					}
-					current_offset += 2;
-					break;
-				case INSTRUCTION_TYPE_3_REGISTER:
-					if (write_buffer(&line.operands[0].reg->id, 1, 1, &buffer) != 1) {
-						printf("Failed to write register id\n");
-						return 0;
-					}
-					if (write_buffer(&line.operands[1].reg->id, 1, 1, &buffer) != 1) {
-						printf("Failed to write register id\n");
-						return 0;
-					}
-					if (write_buffer(&line.operands[2].reg->id, 1, 1, &buffer) != 1) {
-						printf("Failed to write register id\n");
-						return 0;
-					}
-					current_offset += 3;
-					break;
-				case INSTRUCTION_TYPE_1_REGISTER_1_IMMEDIATE:
-					if (write_buffer(&line.operands[0].reg->id, 1, 1, &buffer) != 1) {
-						printf("Failed to write register id\n");
-						return 0;
-					}
-					if (line.operands[1].is_label) {
-						if (write_buffer(&line.operands[1].label->address, 4, 1, &buffer) != 1) {
-							printf("Failed to write label address\n");
-							return 0;
-						}
-					} else {
-						if (write_buffer(&line.operands[1].immediate, 4, 1, &buffer) != 1) {
-							printf("Failed to write immediate\n");
-							return 0;
-						}
-					}
-					current_offset += 5;
-					break;
-                case INSTRUCTION_TYPE_1_IMMEDIATE:
-					if (line.operands[0].is_label) {
-						if (write_buffer(&line.operands[0].label->address, 4, 1, &buffer) != 1) {
-							printf("Failed to write label address\n");
-							return 0;
-						}
-					} else {
-						if (write_buffer(&line.operands[0].immediate, 4, 1, &buffer) != 1) {
-							printf("Failed to write immediate\n");
-							return 0;
-						}
-					}
-                    current_offset += 4;
-                    break;
-				case INSTRUCTION_TYPE_SYSTEM:
-					if (write_buffer(&line.operands[0].imm8, 1, 1, &buffer) != 1) {
-						printf("Failed to write imm8\n");
-						return 0;
-					}
-					current_offset += 1;
-					break;
+
+			if (write_buffer(&symbol, sizeof(elf_symbol_t), 1, &buffer) != 1) {
+				printf("Failed to write symbol\n");
+				return 0;
 			}
 		}
+	}
 
-		header->size = current_offset - header->offset;
+	current_offset += symbol_count * sizeof(elf_symbol_t);
+	headers[symtab_index].size = symbol_count * sizeof(elf_symbol_t);
+
+	headers[strtab_index].offset = current_offset;
+	headers[strtab_index].size = (u32) strtab.size;
+	if (write_buffer(strtab.buffer, strtab.size, 1, &buffer) != 1) {
+		printf("Failed to write symbol names\n");
+		return 0;
+	}
+	current_offset += (u32) strtab.size;
+
+	if (!align_buffer(&buffer, &current_offset, 4)) {
+		return 0;
+	}
+
+	rel_index = strtab_index + 1;
+	for (usize i = 0; i < assembler->section_count; ++i) {
+		section_t* section = &assembler->sections[i];
+		if (section->fixup_count == 0) {
+			continue;
+		}
+
+		headers[rel_index].offset = current_offset;
+		for (usize j = 0; j < section->fixup_count; ++j) {
+			elf_relocation_t relocation = { .offset = section->fixups[j].offset, .info = (symbol_indices[section->fixups[j].label] << 8) | R_KR32_32 };
+			if (write_buffer(&relocation, sizeof(elf_relocation_t), 1, &buffer) != 1) {
+				printf("Failed to write relocation\n");
+				return 0;
+			}
+		}
+
+		headers[rel_index].size = (u32) (section->fixup_count * sizeof(elf_relocation_t));
+		current_offset += headers[rel_index].size;
+		++rel_index;
 	}
 
 	usize final_strtab_size = 0;
-	for (usize i = 0; i < assembler->section_count + assembler->private_section_count; ++i) {
+	for (usize i = 0; i < header_count; ++i) {
 		final_strtab_size += strlen(section_names[i]) + 1;
 	}
 
@@ -1231,7 +1571,8 @@ s32 codegen_obj(assembler_t* assembler, FILE* outfp) {
 	}
 
 	u32 offset = 0;
-	for (usize i = 0; i < assembler->section_count + assembler->private_section_count; ++i) {
+	for (usize i = 0; i < header_count; ++i) {
+		headers[i].name_offset = offset;
 		memcpy(&final_strtab[offset], section_names[i], strlen(section_names[i]) + 1);
 		offset += (u32) strlen(section_names[i]) + 1;
 	}
@@ -1253,7 +1594,7 @@ s32 codegen_obj(assembler_t* assembler, FILE* outfp) {
 	}
 	buffer.size = old_size;
 
-	if (!write_elf_sections(&buffer, headers, (u32) (assembler->section_count + assembler->private_section_count))) {
+	if (!write_elf_sections(&buffer, headers, (u32) header_count)) {
 		printf("Failed to write section headers\n");
 		return 0;
 	}
@@ -1263,263 +1604,444 @@ s32 codegen_obj(assembler_t* assembler, FILE* outfp) {
 		return 0;
 	}
 
-	for (usize i = 2; i < assembler->section_count + assembler->private_section_count; ++i) {
+	for (usize i = 2; i < header_count; ++i) {
 		free((void*) section_names[i]);
 	}
 
 	free(section_names);
 	free(headers);
+	free(symbol_indices);
+	free(strtab.buffer);
 	free(buffer.buffer);
 	free(final_strtab);
 	return 1;
 }
 
-char word_buffer[64];
-char* word_cstring(word_t* word) {
-	memcpy(word_buffer, word->start, word->length % 64);
-	word_buffer[word->length % 64] = '\0';
-	return word_buffer;
+/* bump whenever the encoding or the object layout changes so stale cache entries are never reused */
+#define K32_AS_VERSION "k32-as 3"
+
+typedef struct {
+	const char* asm_file;
+	const char* out_file;
+	s32 out_malloced;
+	s32 succeeded;
+
+	usize index;
+	const char* cache_dir;
+	s32 cache_hit;
+	s32 cache_stored;
+} job_t;
+
+/* 64-bit FNV-1a, continued across the version, the flags and the source */
+u64 hash_bytes(u64 hash, const void* data, usize size) {
+	const u8* p = (const u8*) data;
+	for (usize i = 0; i < size; ++i) {
+		hash = (hash ^ p[i]) * 0x100000001B3ull;
+	}
+
+	return hash;
 }
 
-s32 main(int argc, char** argv) {
-	const char* asm_file = NULL;
-	const char* out_file = NULL;
-	s32 ofile_malloced = 0;
+/* <cache dir>/<source hash>-<source size><suffix>, the size makes a collision need equally long sources */
+char* cache_path(job_t* job, source_t* source, const char* suffix) {
+	/* no flag changes the output yet, new ones must be hashed here */
+	const char* flags = "";
+	u64 hash = 0xCBF29CE484222325ull;
+	hash = hash_bytes(hash, K32_AS_VERSION, sizeof(K32_AS_VERSION));
+	hash = hash_bytes(hash, flags, strlen(flags) + 1);
+	hash = hash_bytes(hash, source->data, source->size);
+
+	usize len = strlen(job->cache_dir) + strlen(suffix) + 64;
+	char* path = (char*) malloc(len);
+	if (path == NULL) {
+		printf("Failed to allocate memory\n");
+		return NULL;
+	}
 
-	#ifdef DEBUG_FIXED_FILES
-	asm_file = "../../../test.asm";
-	out_file = "../../../test.elf";
-	#else
-	if (argc < 2) {
-		printf("Usage: %s <source file> [options]\n", argv[0]);
-		printf("Flags:\n  [-o], [/Fo]\n    <output file>  Output file\n");
-		return 1;
+	snprintf(path, len, "%s/%016llx-%llu%s", job->cache_dir, (unsigned long long) hash, (unsigned long long) source->size, suffix);
+	return path;
+}
+
+/* returns 0 without a message when the source does not exist, a cache miss is not an error */
+s32 copy_file(const char* from, const char* to) {
+	FILE* in = fopen(from, "rb");
+	if (in == NULL) {
+		return 0;
 	}
 
-	for (usize i = 1; i < argc; ++i) {
-		if (strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "/Fo") == 0) {
-			if (i + 1 >= argc) {
-				printf("Expected output file after -o\n");
-				return 1;
-			}
+	FILE* out = fopen(to, "wb");
+	if (out == NULL) {
+		printf("Failed to open output file: %s\n", to);
+		fclose(in);
+		return 0;
+	}
 
-			out_file = argv[i + 1];
+	u8 buffer[0x10000];
+	usize read;
+	s32 result = 1;
+	while ((read = fread(buffer, 1, sizeof(buffer), in)) != 0) {
+		if (fwrite(buffer, 1, read, out) != read) {
+			printf("Failed to write file: %s\n", to);
+			result = 0;
 			break;
-		} else {
-			asm_file = argv[i];
 		}
 	}
 
-	if (asm_file == NULL) {
-		printf("No source file specified\n");
-		return 1;
+	fclose(in);
+	if (fclose(out) != 0) {
+		result = 0;
 	}
+	return result;
+}
 
-	/* asm_file - extension + .elf */
-	if (out_file == NULL) {
-		usize len = strlen(asm_file);
-		usize base_len = len;
-		char* ext = strrchr(asm_file, '.');
-		if (ext == NULL) {
-			len += 4;
-		} else {
-			base_len -= strlen(ext);
-			len = base_len + 4;
-		}
+/* publishes the finished object under a temporary name first so concurrent builds never see a partial entry */
+s32 cache_store(job_t* job, const char* path) {
+	usize len = strlen(path) + 64;
+	char* temp = (char*) malloc(len);
+	if (temp == NULL) {
+		printf("Failed to allocate memory\n");
+		return 0;
+	}
 
-		out_file = (char*) malloc(len + 1);
-		if (out_file == NULL) {
-			printf("Failed to allocate memory\n");
-			return 1;
-		}
+	snprintf(temp, len, "%s.%lu.%llu.tmp", path, (unsigned long) getpid(), (unsigned long long) job->index);
+	s32 stored = copy_file(job->out_file, temp);
+	if (stored && rename(temp, path) != 0) {
+		/* another build may have published the same entry first, which is just as good */
+		stored = 0;
+	}
 
-		strncpy((char*) out_file, asm_file, base_len);
-		strncpy((char*) &out_file[base_len], ".elf", 4);
-		((char*) out_file)[len] = '\0';
-		ofile_malloced = 1;
+	if (!stored) {
+		remove(temp);
 	}
-	#endif
 
-	char* buffer = NULL;
-	usize size = 0;
-	{
-		FILE* file = fopen(asm_file, "rb");
-		if (file == NULL) {
-			printf("Failed to open file: %s\n", asm_file);
-			return 1;
+	free(temp);
+	return stored;
+}
+
+/* everything one translation unit needs lives here, so jobs on different threads share nothing mutable */
+s32 assemble(assembler_t* assembler, source_t* source, const char* out_file) {
+	lexer_t lexer = { .cursor = source->data, .end = source->data + source->size, .line_start = source->data, .line = 1, .file = assembler->file };
+	token_t token;
+	s32 result;
+	while ((result = next_token(&lexer, &token)) == 1) {
+		assembler->line = token.line;
+		assembler->column = token.column;
+		if (!process_word(assembler, &token)) {
+			return 0;
 		}
+	}
 
-		fseek(file, 0, SEEK_END);
-		size = ftell(file);
-		fseek(file, 0, SEEK_SET);
+	if (result < 0) {
+		return 0;
+	}
 
-		buffer = (char*) malloc(size + 1);
-		if (buffer == NULL) {
-			printf("Failed to allocate memory\n");
-			return 1;
-		}
+	if (!finish_instruction(assembler)) {
+		return 0;
+	}
 
-		fread(buffer, 1, size, file);
-		buffer[size] = '\0';
-		fclose(file);
+	if (!evaluate_labels(assembler)) {
+		return 0;
 	}
 
-	/* init maps */
-	for (u16 i = 0; i < sizeof(instructions) / sizeof(instruction_t); ++i) {
-		if (instructions[i].name != NULL) {
-			instructions[i].hash = hash_string(instructions[i].name);
-		}
+	FILE* outfp = fopen(out_file, "wb");
+	if (outfp == NULL) {
+		printf("Failed to open output file: %s\n", out_file);
+		return 0;
 	}
 
-	for (u16 i = 0; i < sizeof(registers) / sizeof(reg_t); ++i) {
-		if (registers[i].name != NULL) {
-			registers[i].hash = hash_string(registers[i].name);
+	s32 written = codegen_obj(assembler, outfp);
+	fflush(outfp);
+	fclose(outfp);
+	return written;
+}
+
+s32 assemble_file(job_t* job) {
+	source_t source;
+	if (!open_source(job->asm_file, &source)) {
+		return 0;
+	}
+
+	char* cached = NULL;
+	if (job->cache_dir != NULL) {
+		cached = cache_path(job, &source, ".elf");
+		if (cached != NULL && copy_file(cached, job->out_file)) {
+			job->cache_hit = 1;
+			free(cached);
+			close_source(&source);
+			return 1;
 		}
 	}
 
-	assembler_t assembler = { .lines = NULL, .line_count = 0, .current_address = 0, .current_section = 0, .labels = NULL, .label_count = 0, .sections = NULL, .section_count = 0 };
-	assembler.sections = malloc(sizeof(section_t));
-	if (assembler.sections == NULL) {
-		printf("Failed to allocate memory\n");
-		return 1;
+	assembler_t assembler = { .current_address = 0, .current_section = 0, .pending = NULL, .labels = NULL, .label_count = 0, .symbols = { 0 }, .sections = NULL, .section_count = 0 };
+	if (!reserve_array((void**) &assembler.sections, &assembler.section_capacity, 1, sizeof(section_t))) {
+		if (cached != NULL) {
+			free(cached);
+		}
+		close_source(&source);
+		return 0;
 	}
 
-	text_section.hash = hash_string(".text");
 	assembler.sections[0] = text_section;
+	assembler.sections[0].hash = hash_string(".text");
 	assembler.current_section = 0;
 	assembler.section_count = 1;
 	assembler.private_section_count = 2;
+	assembler.file = job->asm_file;
 
-	word_t word;
-	usize index = 0;
-	usize s = size;
-	while (retrieve_word(&buffer[index], s, &word)) {
-		if (word.length == 0) {
-			while (buffer[index] == ' ' || buffer[index] == '\t' || buffer[index] == '\n' || buffer[index] == '\r') {
-				++index;
-				--s;
-
-				if (s == 0) {
-					break;
-				}
+	s32 result = assemble(&assembler, &source, job->out_file);
+	if (!result) {
+		printf("Failed to assemble %s\n", job->asm_file);
+	} else if (cached != NULL) {
+		job->cache_stored = cache_store(job, cached);
+	}
 
-				if (buffer[index] == '\0') {
-					break;
-				}
-			}
+	if (cached != NULL) {
+		free(cached);
+	}
 
-			continue;
+	if (assembler.labels != NULL) {
+		free(assembler.labels);
+	}
+
+	if (assembler.symbols.slots != NULL) {
+		free(assembler.symbols.slots);
+	}
+
+	if (assembler.globals != NULL) {
+		free(assembler.globals);
+	}
+
+	for (usize i = 0; i < assembler.section_count; ++i) {
+		free(assembler.sections[i].bytes.buffer);
+		free(assembler.sections[i].fixups);
+	}
+
+	free(assembler.sections);
+	close_source(&source);
+	return result;
+}
+
+typedef struct {
+	job_t* jobs;
+	usize job_count;
+	usize next_job;
+	mutex_t lock;
+} job_queue_t;
+
+THREAD_RESULT worker(void* data) {
+	job_queue_t* queue = (job_queue_t*) data;
+	while (1) {
+		mutex_lock(&queue->lock);
+		usize index = queue->next_job++;
+		mutex_unlock(&queue->lock);
+
+		if (index >= queue->job_count) {
+			break;
 		}
 
-		if (word.start[0] == '/' && word.length >= 2) {
-			if (word.start[1] == '/') {
-				while (buffer[index] != '\n') {
-					if (buffer[index] == '\r') {
-						if (s >= 1 && buffer[index] != '\n') {
-							break;
-						}
-					}
+		queue->jobs[index].succeeded = assemble_file(&queue->jobs[index]);
+	}
 
-					++index;
-					--s;
+	return 0;
+}
 
-					if (s == 0) {
-						printf("Unterminated comment\n");
-						return 0;
-					}
+/* input - extension + .elf */
+const char* default_out_file(const char* asm_file) {
+	usize len = strlen(asm_file);
+	usize base_len = len;
+	const char* ext = strrchr(asm_file, '.');
+	if (ext == NULL) {
+		len += 4;
+	} else {
+		base_len -= strlen(ext);
+		len = base_len + 4;
+	}
 
-					if (buffer[index] == '\0') {
-						printf("Unterminated comment\n");
-						return 0;
-					}
-				}
+	char* out_file = (char*) malloc(len + 1);
+	if (out_file == NULL) {
+		printf("Failed to allocate memory\n");
+		return NULL;
+	}
 
-				continue;
-			} else if (word.start[1] == '*') {
-				word_t w;
-				while (1) {
-					if (!retrieve_word(&buffer[index], s, &w)) {
-						printf("Unterminated comment\n");
-						return 0;
-					}
-
-					index += w.length + 1;
-					s -= w.length + 1;
-
-					if (w.length == 2 && w.start[0] == '*' && w.start[1] == '/') {
-						break;
-					}
-				}
+	strncpy(out_file, asm_file, base_len);
+	strncpy(&out_file[base_len], ".elf", 4);
+	out_file[len] = '\0';
+	return out_file;
+}
 
-				if (s == 0) {
-					break;
-				}
+s32 write_stats(const char* path, job_t* jobs, usize job_count) {
+	FILE* file = fopen(path, "w");
+	if (file == NULL) {
+		printf("Failed to open stats file: %s\n", path);
+		return 0;
+	}
 
-				if (buffer[index] == '\0') {
-					break;
-				}
+	usize failed = 0;
+	usize hits = 0;
+	usize stores = 0;
+	for (usize i = 0; i < job_count; ++i) {
+		failed += !jobs[i].succeeded;
+		hits += jobs[i].cache_hit;
+		stores += jobs[i].cache_stored;
+	}
 
-				continue;
-			}
-		}
+	fprintf(file, "{\n");
+	fprintf(file, "  \"sources\": %llu,\n", (unsigned long long) job_count);
+	fprintf(file, "  \"failed\": %llu,\n", (unsigned long long) failed);
+	fprintf(file, "  \"cache_hits\": %llu,\n", (unsigned long long) hits);
+	fprintf(file, "  \"cache_misses\": %llu,\n", (unsigned long long) ((jobs[0].cache_dir == NULL) ? 0 : job_count - hits));
+	fprintf(file, "  \"cache_stores\": %llu\n", (unsigned long long) stores);
+	fprintf(file, "}\n");
+	fclose(file);
+	return 1;
+}
 
-		index += word.length + 1;
-		s -= word.length + 1;
+s32 main(int argc, char** argv) {
+	const char* out_file = NULL;
+	const char* cache_dir = NULL;
+	const char* stats_file = NULL;
+	u32 thread_count = 1;
 
-		if (word.start[word.length - 1] == ',') {
-			--word.length;
-		}
+	job_t* jobs = (job_t*) calloc(argc + 1, sizeof(job_t));
+	if (jobs == NULL) {
+		printf("Failed to allocate memory\n");
+		return 1;
+	}
+	usize job_count = 0;
 
-		if (!process_word(&assembler, &word)) {
-			return 0;
-		}
+	#ifdef DEBUG_FIXED_FILES
+	jobs[job_count++].asm_file = "../../../test.asm";
+	out_file = "../../../test.elf";
+	#else
+	if (argc < 2) {
+		printf("Usage: %s <source file>... [options]\n", argv[0]);
+		printf("Flags:\n  [-o], [/Fo]\n    <output file>  Output file, only with a single source file\n");
+		printf("  [-j]\n    <count>  Assemble up to this many source files in parallel (default 1)\n");
+		printf("  [--cache-dir]\n    <directory>  Reuse objects of sources assembled before with the same content and assembler version\n");
+		printf("  [--stats]\n    <file>  Write source and cache hit counts as JSON\n");
+		printf("Each source file is assembled on its own into <source file without extension>.elf\n");
+		return 1;
+	}
 
-	    if (index >= size) {
-			break;
-		}
+	for (usize i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "/Fo") == 0) {
+			if (i + 1 >= argc) {
+				printf("Expected output file after -o\n");
+				return 1;
+			}
 
-		if (s == 0) {
-			break;
-		}
+			out_file = argv[++i];
+		} else if (strcmp(argv[i], "-j") == 0) {
+			if (i + 1 >= argc) {
+				printf("Expected job count after -j\n");
+				return 1;
+			}
 
-		if (index + word.length >= size) {
-			break;
-		}
+			thread_count = (u32) strtoul(argv[++i], NULL, 10);
+			if (thread_count == 0) {
+				printf("Job count must be at least 1\n");
+				return 1;
+			}
+		} else if (strcmp(argv[i], "--cache-dir") == 0) {
+			if (i + 1 >= argc) {
+				printf("Expected directory after --cache-dir\n");
+				return 1;
+			}
 
-		if (buffer[index] == '\0') {
-			break;
+			cache_dir = argv[++i];
+		} else if (strcmp(argv[i], "--stats") == 0) {
+			if (i + 1 >= argc) {
+				printf("Expected file after --stats\n");
+				return 1;
+			}
+
+			stats_file = argv[++i];
+		} else {
+			jobs[job_count++].asm_file = argv[i];
 		}
 	}
+	#endif
 
-	if (!evaluate_labels(&assembler)) {
-		return 0;
+	if (job_count == 0) {
+		printf("No source file specified\n");
+		return 1;
 	}
 
-	FILE* outfp = fopen(out_file, "wb");
-	if (ofile_malloced) {
-		free((void*) out_file);
+	if (out_file != NULL && job_count > 1) {
+		printf("-o can only be used with a single source file\n");
+		return 1;
 	}
 
-	if (outfp == NULL) {
-		printf("Failed to open output file\n");
-		return 1;
+	if (cache_dir != NULL) {
+		/* an existing directory makes mkdir fail, anything else shows up when the first entry is stored */
+		mkdir(cache_dir, 0777);
 	}
 
-	codegen_obj(&assembler, outfp);
-	fflush(outfp);
-	fclose(outfp);
+	for (usize i = 0; i < job_count; ++i) {
+		jobs[i].index = i;
+		jobs[i].cache_dir = cache_dir;
+		if (out_file != NULL) {
+			jobs[i].out_file = out_file;
+		} else {
+			jobs[i].out_file = default_out_file(jobs[i].asm_file);
+			if (jobs[i].out_file == NULL) {
+				return 1;
+			}
+			jobs[i].out_malloced = 1;
+		}
+	}
 
-	if (assembler.lines != NULL) {
-		free(assembler.lines);
+	if (thread_count > job_count) {
+		thread_count = (u32) job_count;
 	}
 
-	if (assembler.labels != NULL) {
-		free(assembler.labels);
+	job_queue_t queue = { .jobs = jobs, .job_count = job_count, .next_job = 0 };
+	mutex_init(&queue.lock);
+	if (thread_count == 1) {
+		worker(&queue);
+	} else {
+		thread_t* threads = (thread_t*) malloc(sizeof(thread_t) * thread_count);
+		if (threads == NULL) {
+			printf("Failed to allocate memory\n");
+			return 1;
+		}
+
+		/* the calling thread stays idle so a failed thread start only costs parallelism */
+		u32 started = 0;
+		for (u32 i = 0; i < thread_count; ++i) {
+			if (!thread_start(&threads[started], worker, &queue)) {
+				printf("Warning: failed to start worker thread\n");
+				continue;
+			}
+			++started;
+		}
+
+		if (started == 0) {
+			worker(&queue);
+		}
+
+		for (u32 i = 0; i < started; ++i) {
+			thread_join(threads[i]);
+		}
+		free(threads);
 	}
+	mutex_destroy(&queue.lock);
 
-	if (assembler.labels != NULL) {
-		free(assembler.sections);
+	if (stats_file != NULL) {
+		write_stats(stats_file, jobs, job_count);
+	}
+
+	s32 failed = 0;
+	for (usize i = 0; i < job_count; ++i) {
+		if (!jobs[i].succeeded) {
+			failed = 1;
+		}
+
+		if (jobs[i].out_malloced) {
+			free((void*) jobs[i].out_file);
+		}
 	}
 
-	free(buffer);
+	free(jobs);
+	return failed;
 }
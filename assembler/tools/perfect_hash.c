@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+
+typedef float f32;
+typedef double f64;
+
+typedef size_t usize;
+
+/*
+ * Generates the perfect hash tables for the mnemonics and register names in assembler/src/main.c.
+ * The names are read from the instructions[] and registers[] initializers so the tables can not drift
+ * from the ISA; paste the output over the generated block in main.c whenever either list changes.
+ */
+
+#define MAX_NAMES 256
+#define MAX_TABLE_BITS 10
+#define MAX_MULTIPLIER 0x100000
+
+typedef struct {
+	char* names[MAX_NAMES];
+	usize count;
+} name_list_t;
+
+/* must stay identical to perfect_hash() in assembler/src/main.c */
+u32 perfect_hash(const char* name, usize length, u32 multiplier, u32 bits) {
+	u32 h = (u32) length;
+	h = h * multiplier + (u8) name[0];
+	h = h * multiplier + (u8) name[length - 1];
+	h = h * multiplier + (u8) name[length / 2];
+	return (h ^ (h >> 15)) & ((1u << bits) - 1);
+}
+
+/* collects every .name = "..." between the start of the named initializer and its closing "};" */
+s32 collect_names(char* source, const char* array, name_list_t* list) {
+	char* begin = strstr(source, array);
+	if (begin == NULL) {
+		printf("'%s' not found\n", array);
+		return 0;
+	}
+
+	char* end = strstr(begin, "};");
+	if (end == NULL) {
+		printf("'%s' is not terminated\n", array);
+		return 0;
+	}
+
+	list->count = 0;
+	char* p = begin;
+	while ((p = strstr(p, ".name = \"")) != NULL && p < end) {
+		p += 9;
+		char* close = strchr(p, '"');
+		if (close == NULL || list->count == MAX_NAMES) {
+			printf("Malformed name in '%s'\n", array);
+			return 0;
+		}
+
+		*close = '\0';
+		list->names[list->count++] = p;
+		p = close + 1;
+	}
+
+	return list->count != 0;
+}
+
+s32 search(name_list_t* list, u32* multiplier, u32* bits) {
+	u8 used[1 << MAX_TABLE_BITS];
+	u32 min_bits = 1;
+	while ((1u << min_bits) < list->count) {
+		++min_bits;
+	}
+
+	for (u32 b = min_bits; b <= MAX_TABLE_BITS; ++b) {
+		for (u32 m = 1; m < MAX_MULTIPLIER; ++m) {
+			memset(used, 0, (usize) 1 << b);
+			usize i = 0;
+			for (; i < list->count; ++i) {
+				u32 slot = perfect_hash(list->names[i], strlen(list->names[i]), m, b);
+				if (used[slot]) {
+					break;
+				}
+				used[slot] = 1;
+			}
+
+			if (i == list->count) {
+				*multiplier = m;
+				*bits = b;
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+s32 emit_table(name_list_t* list, const char* prefix, const char* table, const char* array) {
+	u32 multiplier = 0;
+	u32 bits = 0;
+	if (!search(list, &multiplier, &bits)) {
+		printf("No perfect hash found for %s\n", array);
+		return 0;
+	}
+
+	u32 slots[1 << MAX_TABLE_BITS] = { 0 };
+	for (usize i = 0; i < list->count; ++i) {
+		slots[perfect_hash(list->names[i], strlen(list->names[i]), multiplier, bits)] = (u32) i + 1;
+	}
+
+	printf("#define %s_HASH_MULTIPLIER %u\n", prefix, multiplier);
+	printf("#define %s_HASH_BITS %u\n", prefix, bits);
+	printf("u8 %s[1 << %s_HASH_BITS] = {", table, prefix);
+	for (u32 i = 0; i < (1u << bits); ++i) {
+		printf("%s%u,", (i % 16 == 0) ? "\n\t" : " ", slots[i]);
+	}
+	printf("\n};\n");
+	return 1;
+}
+
+int main(s32 argc, char** argv) {
+	if (argc != 2) {
+		printf("Usage: %s <assembler/src/main.c>\n", argv[0]);
+		return 1;
+	}
+
+	FILE* file = fopen(argv[1], "rb");
+	if (file == NULL) {
+		printf("Failed to open file: %s\n", argv[1]);
+		return 1;
+	}
+
+	fseek(file, 0, SEEK_END);
+	usize size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	char* source = (char*) malloc(size + 1);
+	if (source == NULL) {
+		printf("Failed to allocate memory\n");
+		return 1;
+	}
+
+	if (fread(source, 1, size, file) != size) {
+		printf("Failed to read file: %s\n", argv[1]);
+		return 1;
+	}
+	source[size] = '\0';
+	fclose(file);
+
+	/* the register scan runs first since collect_names terminates the names in place */
+	name_list_t registers;
+	name_list_t instructions;
+	if (!collect_names(source, "reg_t registers[] = {", &registers) || !collect_names(source, "instruction_t instructions[] = {", &instructions)) {
+		return 1;
+	}
+
+	printf("/* generated by assembler/tools/perfect_hash.c, slot values are index + 1 and 0 is empty */\n");
+	if (!emit_table(&instructions, "INSTRUCTION", "instruction_slots", "instructions") || !emit_table(&registers, "REGISTER", "register_slots", "registers")) {
+		return 1;
+	}
+
+	free(source);
+	return 0;
+}
@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+
+typedef float f32;
+typedef double f64;
+
+typedef size_t usize;
+
+/* only the instructions whose operands are plain registers, so any pick assembles */
+char* alu_mnemonics[] = { "add", "sub", "mul", "shr", "shl", "and", "or", "xor" };
+
+typedef struct {
+	u64 lines;
+	u32 sections;
+	u32 function_lines;
+	u32 label_every;
+	u32 data_percent;
+	u64 seed;
+} generator_t;
+
+void print_help(s32 argc, char** argv) {
+	printf("Usage: %s -o <output file> [options]\n", argv[0]);
+	printf("Generates a synthetic kr32 assembly file for toolchain benchmarks\n");
+	printf("Flags:\n  [-n, --lines] <count> Approximate number of lines to generate (default 10000, K/M suffixes allowed)\n");
+	printf("  [--sections] <count> Data sections besides .text (default 4)\n");
+	printf("  [--function-lines] <count> Lines per generated function (default 64)\n");
+	printf("  [--label-every] <count> Local label density inside functions, one per this many lines (default 8)\n");
+	printf("  [--data-percent] <percent> Share of lines that are data directives (default 20)\n");
+	printf("  [--seed] <value> Random seed (default 1)\n");
+	printf("  [-h, --help] Print help message\n");
+}
+
+u64 parse_count(char* str) {
+	char* end = NULL;
+	u64 value = strtoull(str, &end, 10);
+	if (*end == 'K') {
+		value *= 1000;
+	} else if (*end == 'M') {
+		value *= 1000000;
+	}
+	return value;
+}
+
+/* xorshift64, the output only has to be reproducible for a given seed */
+u64 next_random(u64* state) {
+	u64 x = *state;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	*state = x;
+	return x;
+}
+
+u32 random_below(u64* state, u32 bound) {
+	return (u32) (next_random(state) % bound);
+}
+
+int main(s32 argc, char** argv) {
+	generator_t gen = { .lines = 10000, .sections = 4, .function_lines = 64, .label_every = 8, .data_percent = 20, .seed = 1 };
+	char* out_file = NULL;
+	for (s32 i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			out_file = argv[++i];
+		} else if ((strcmp(argv[i], "-n") == 0 || strcmp(argv[i], "--lines") == 0) && i + 1 < argc) {
+			gen.lines = parse_count(argv[++i]);
+		} else if (strcmp(argv[i], "--sections") == 0 && i + 1 < argc) {
+			gen.sections = (u32) parse_count(argv[++i]);
+		} else if (strcmp(argv[i], "--function-lines") == 0 && i + 1 < argc) {
+			gen.function_lines = (u32) parse_count(argv[++i]);
+		} else if (strcmp(argv[i], "--label-every") == 0 && i + 1 < argc) {
+			gen.label_every = (u32) parse_count(argv[++i]);
+		} else if (strcmp(argv[i], "--data-percent") == 0 && i + 1 < argc) {
+			gen.data_percent = (u32) parse_count(argv[++i]);
+		} else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+			gen.seed = parse_count(argv[++i]);
+		} else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+			print_help(argc, argv);
+			return 0;
+		} else {
+			printf("Unknown argument (%d): %s\n", i, argv[i]);
+			print_help(argc, argv);
+			return 1;
+		}
+	}
+
+	if (out_file == NULL || gen.lines == 0 || gen.function_lines < 4 || gen.label_every == 0 || gen.data_percent > 90) {
+		print_help(argc, argv);
+		return 1;
+	}
+
+	FILE* file = fopen(out_file, "w");
+	if (file == NULL) {
+		printf("Failed to open output file: %s\n", out_file);
+		return 1;
+	}
+
+	u64 state = (gen.seed == 0) ? 1 : gen.seed;
+	u64 data_lines = gen.lines * gen.data_percent / 100;
+	u64 text_lines = gen.lines - data_lines;
+	u64 function_count = (text_lines + gen.function_lines - 1) / gen.function_lines;
+	u32 section_count = (gen.sections == 0 || data_lines == 0) ? 0 : gen.sections;
+	u64 data_per_section = (section_count == 0) ? 0 : data_lines / section_count;
+	/* one data label per 16 directives, referenced from the code so the assembler has to resolve across sections */
+	u64 data_label_count = (data_per_section + 15) / 16 * section_count;
+
+	fprintf(file, "// generated by k32-asmgen: %llu lines, %u data sections, seed %llu\n", (unsigned long long) gen.lines, section_count, (unsigned long long) gen.seed);
+	fprintf(file, ".text\n\nstart:\n    ldi sp, 0x10000\n    ldi r0, f_0\n    link r0\n    hlt\n\n");
+
+	u64 written = 0;
+	for (u64 f = 0; f < function_count && written < text_lines; ++f) {
+		fprintf(file, "f_%llu:\n", (unsigned long long) f);
+		u32 labels = 0;
+		for (u32 l = 0; l < gen.function_lines - 1 && written < text_lines; ++l, ++written) {
+			if (l != 0 && (l % gen.label_every) == 0) {
+				fprintf(file, "    f_%llu_l%u:\n", (unsigned long long) f, labels++);
+			}
+
+			u32 kind = random_below(&state, 16);
+			if (kind < 10) {
+				fprintf(file, "        %s r%u, r%u, r%u\n", alu_mnemonics[random_below(&state, 8)], random_below(&state, 16), random_below(&state, 16), random_below(&state, 16));
+			} else if (kind < 12) {
+				fprintf(file, "        ldi r%u, 0x%08x\n", random_below(&state, 16), (u32) next_random(&state));
+			} else if (kind < 13 && labels != 0) {
+				/* backwards branch to a local label of this function */
+				fprintf(file, "        jnzi r%u, f_%llu_l%u\n", random_below(&state, 16), (unsigned long long) f, random_below(&state, labels));
+			} else if (kind < 14 && function_count > 1) {
+				/* forward or backward reference to another function's entry */
+				fprintf(file, "        ldi r0, f_%llu\n", (unsigned long long) (next_random(&state) % function_count));
+			} else if (kind < 15 && data_label_count != 0) {
+				fprintf(file, "        ldi r1, d_%llu\n", (unsigned long long) (next_random(&state) % data_label_count));
+			} else {
+				fprintf(file, "        push r%u\n", random_below(&state, 16));
+			}
+		}
+
+		fprintf(file, "    ret\n\n");
+		++written;
+	}
+
+	u64 data_label = 0;
+	for (u32 s = 0; s < section_count; ++s) {
+		fprintf(file, ".data%u\n", s);
+		for (u64 d = 0; d < data_per_section; ++d) {
+			if ((d % 16) == 0) {
+				fprintf(file, "d_%llu:\n", (unsigned long long) data_label++);
+			}
+
+			/* every width the '=' directive supports, chosen by the digit count */
+			switch (random_below(&state, 4)) {
+			case 0:
+				fprintf(file, "    =0x%02x\n", (u32) (next_random(&state) & 0xFF));
+				break;
+			case 1:
+				fprintf(file, "    =0x%04x\n", (u32) (next_random(&state) & 0xFFFF));
+				break;
+			case 2:
+				fprintf(file, "    =0x%08x\n", (u32) next_random(&state));
+				break;
+			default:
+				fprintf(file, "    =0x%016llx\n", (unsigned long long) next_random(&state));
+				break;
+			}
+		}
+		fprintf(file, "\n");
+	}
+
+	fclose(file);
+	return 0;
+}
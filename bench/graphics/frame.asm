@@ -0,0 +1,24 @@
+// full-frame redraws, one str8 per pixel with the colour shifting every frame
+.text
+
+start:
+    ldi sp, 0x10000
+    ldi r1, 1
+    ldi r2, 0xF0000000
+    ldi r3, 9600
+    ldi r8, 0
+
+    frame:
+        ldr r4, r2
+        ldr r5, r3
+        ldr r6, r8
+
+        pixel:
+            str8 r4, r6
+            add r4, r4, r1
+            add r6, r6, r1
+            sub r5, r5, r1
+            jnzi r5, pixel
+
+        add r8, r8, r1
+        jmpi frame
@@ -0,0 +1,32 @@
+// framebuffer readback: a checksum over every pixel, then each pixel rewritten from what was read
+.text
+
+start:
+    ldi sp, 0x10000
+    ldi r1, 1
+    ldi r2, 0xF0000000
+    ldi r3, 9600
+
+    frame:
+        ldr r4, r2
+        ldr r5, r3
+
+        read:
+            ldm8 r6, r4
+            add r7, r7, r6
+            add r4, r4, r1
+            sub r5, r5, r1
+            jnzi r5, read
+
+        ldr r4, r2
+        ldr r5, r3
+
+        modify:
+            ldm8 r6, r4
+            add r6, r6, r1
+            str8 r4, r6
+            add r4, r4, r1
+            sub r5, r5, r1
+            jnzi r5, modify
+
+        jmpi frame
@@ -0,0 +1,31 @@
+// sparse updates: one pixel at a xorshift32-chosen position per round of unrelated work
+.text
+
+start:
+    ldi sp, 0x10000
+    ldi r1, 1
+    ldi r2, 0xF0000000
+    ldi r3, 9600
+    ldi r5, 0x2545F491
+    ldi r11, 5
+    ldi r12, 17
+    ldi r13, 13
+
+    loop:
+        shl r6, r5, r13
+        xor r5, r5, r6
+        shr r6, r5, r12
+        xor r5, r5, r6
+        shl r6, r5, r11
+        xor r5, r5, r6
+
+        // stand-in for the game logic between draws
+        add r7, r7, r5
+        xor r8, r8, r7
+        add r9, r9, r8
+        xor r10, r10, r9
+
+        rem r4, r5, r3
+        add r4, r4, r2
+        str8 r4, r5
+        jmpi loop
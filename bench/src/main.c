@@ -0,0 +1,377 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+
+typedef float f32;
+typedef double f64;
+
+typedef size_t usize;
+
+#ifdef _WIN32
+#define NULL_DEVICE "NUL"
+#define PATH_SEPARATOR '\\'
+#else
+#define NULL_DEVICE "/dev/null"
+#define PATH_SEPARATOR '/'
+#endif
+
+#define COMMAND_SIZE 4096
+#define MAX_RUNS 1000
+
+typedef struct {
+	char* assembler;
+	char* linker;
+	char* emulator;
+	char* out_dir;
+	char* emulator_args;
+	char* memory;
+	char* budget;
+	u32 runs;
+	FILE* csv;
+	/* windowed runs under a headless SDL video driver, reporting pixel throughput and present cost */
+	s32 graphics;
+} bench_t;
+
+typedef struct {
+	f64 mean;
+	f64 stddev;
+	f64 min;
+	f64 max;
+} summary_t;
+
+void print_help(s32 argc, char** argv) {
+	printf("Usage: %s --as <k32-as> --ld <k32-ld> --emu <k32-emu> --out <dir> [options] <workload.asm>...\n", argv[0]);
+	printf("Flags:\n  [-r, --runs] <count> Emulator runs per workload (default 5)\n");
+	printf("  [-b, --budget] <instructions> Instruction budget per run, workloads loop until it is spent (default 50M)\n");
+	printf("  [-m, --memory] <size> Emulator memory size (default 1M)\n");
+	printf("  [--emu-args] <args> Extra arguments passed to every emulator run\n");
+	printf("  [--csv] <file> Also write one line per workload to a CSV file\n");
+	printf("  [-g, --graphics] Run with --graphical under SDL_VIDEODRIVER (default dummy) and report pixels/s and frame present cost\n");
+	printf("  [--video-driver] <name> SDL video driver for --graphics, such as dummy or offscreen\n");
+	printf("  [-h, --help] Print help message\n");
+}
+
+f64 now_seconds(void) {
+#ifdef _WIN32
+	LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return (f64) counter.QuadPart / (f64) frequency.QuadPart;
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (f64) now.tv_sec + (f64) now.tv_nsec / 1000000000.0;
+#endif
+}
+
+/* runs a command with its output discarded, the tools print warnings we do not want in the report */
+s32 run_quiet(char* command) {
+	char quiet[COMMAND_SIZE + 32];
+	snprintf(quiet, sizeof(quiet), "%s > " NULL_DEVICE " 2>&1", command);
+	return system(quiet) == 0;
+}
+
+/* the emulator's --stats output is simple enough that a key search is all the parsing needed, 'a.b' finds b after a */
+s32 read_stat(char* path, char* key, f64* out) {
+	FILE* file = fopen(path, "rb");
+	if (file == NULL) {
+		return 0;
+	}
+
+	char buffer[16384];
+	usize size = fread(buffer, 1, sizeof(buffer) - 1, file);
+	buffer[size] = '\0';
+	fclose(file);
+
+	char pattern[64];
+	char* found = buffer;
+	char* part = key;
+	while (1) {
+		char* dot = strchr(part, '.');
+		usize length = (dot == NULL) ? strlen(part) : (usize) (dot - part);
+		snprintf(pattern, sizeof(pattern), "\"%.*s\":", (int) length, part);
+		found = strstr(found, pattern);
+		if (found == NULL) {
+			return 0;
+		}
+
+		found += strlen(pattern);
+		if (dot == NULL) {
+			break;
+		}
+		part = dot + 1;
+	}
+
+	*out = strtod(found, NULL);
+	return 1;
+}
+
+summary_t summarize(f64* values, u32 count) {
+	summary_t summary = { .mean = 0.0, .stddev = 0.0, .min = values[0], .max = values[0] };
+	for (u32 i = 0; i < count; ++i) {
+		summary.mean += values[i];
+		summary.min = (values[i] < summary.min) ? values[i] : summary.min;
+		summary.max = (values[i] > summary.max) ? values[i] : summary.max;
+	}
+	summary.mean /= (f64) count;
+
+	if (count > 1) {
+		f64 sum = 0.0;
+		for (u32 i = 0; i < count; ++i) {
+			sum += (values[i] - summary.mean) * (values[i] - summary.mean);
+		}
+		summary.stddev = sqrt(sum / (f64) (count - 1));
+	}
+
+	return summary;
+}
+
+s32 bench_workload(bench_t* bench, char* source) {
+	char* base = strrchr(source, PATH_SEPARATOR);
+#ifdef _WIN32
+	char* slash = strrchr(source, '/');
+	if (slash != NULL && (base == NULL || slash > base)) {
+		base = slash;
+	}
+#endif
+	base = (base == NULL) ? source : base + 1;
+
+	char name[256];
+	snprintf(name, sizeof(name), "%s", base);
+	char* ext = strrchr(name, '.');
+	if (ext != NULL) {
+		*ext = '\0';
+	}
+
+	char object[1024];
+	char image[1024];
+	char stats[1024];
+	snprintf(object, sizeof(object), "%s%c%s.o", bench->out_dir, PATH_SEPARATOR, name);
+	snprintf(image, sizeof(image), "%s%c%s.bin", bench->out_dir, PATH_SEPARATOR, name);
+	snprintf(stats, sizeof(stats), "%s%c%s.json", bench->out_dir, PATH_SEPARATOR, name);
+
+	char command[COMMAND_SIZE];
+	snprintf(command, sizeof(command), "\"%s\" \"%s\" -o \"%s\"", bench->assembler, source, object);
+	if (!run_quiet(command)) {
+		printf("%-12s failed to assemble: %s\n", name, command);
+		return 0;
+	}
+
+	snprintf(command, sizeof(command), "\"%s\" \"%s\" -o \"%s\" --base 0", bench->linker, object, image);
+	if (!run_quiet(command)) {
+		printf("%-12s failed to link: %s\n", name, command);
+		return 0;
+	}
+
+	f64 walls[MAX_RUNS];
+	f64 mips[MAX_RUNS];
+	f64 pixel_rates[MAX_RUNS];
+	f64 presents[MAX_RUNS];
+	f64 present_p99 = 0.0;
+	f64 frames = 0.0;
+	f64 retired = 0.0;
+	if (!bench->graphics) {
+		/*
+		 * --stats puts the emulator on its per-instruction path, so it only counts the retired instructions once here
+		 * and the timed runs go without it, measuring the plain interpreter from outside
+		 */
+		remove(stats);
+		snprintf(command, sizeof(command), "\"%s\" \"%s\" -m %s --max-instructions %s --stats \"%s\" %s", bench->emulator, image,
+			bench->memory, bench->budget, stats, (bench->emulator_args != NULL) ? bench->emulator_args : "");
+		if (!run_quiet(command)) {
+			printf("%-12s emulator failed: %s\n", name, command);
+			return 0;
+		}
+
+		if (!read_stat(stats, "retired", &retired)) {
+			printf("%-12s no statistics in %s\n", name, stats);
+			return 0;
+		}
+
+		for (u32 i = 0; i < bench->runs; ++i) {
+			snprintf(command, sizeof(command), "\"%s\" \"%s\" -m %s --max-instructions %s %s", bench->emulator, image,
+				bench->memory, bench->budget, (bench->emulator_args != NULL) ? bench->emulator_args : "");
+			f64 start = now_seconds();
+			if (!run_quiet(command)) {
+				printf("%-12s emulator failed: %s\n", name, command);
+				return 0;
+			}
+
+			walls[i] = now_seconds() - start;
+			mips[i] = (walls[i] > 0.0) ? retired / walls[i] / 1000000.0 : 0.0;
+		}
+	} else {
+		for (u32 i = 0; i < bench->runs; ++i) {
+			remove(stats);
+			snprintf(command, sizeof(command), "\"%s\" \"%s\" -m %s --max-instructions %s --stats \"%s\" --graphical --latency %s", bench->emulator, image,
+				bench->memory, bench->budget, stats, (bench->emulator_args != NULL) ? bench->emulator_args : "");
+			if (!run_quiet(command)) {
+				printf("%-12s emulator failed: %s\n", name, command);
+				return 0;
+			}
+
+			if (!read_stat(stats, "wall_seconds", &walls[i]) || !read_stat(stats, "mips", &mips[i]) || !read_stat(stats, "retired", &retired)) {
+				printf("%-12s no statistics in %s\n", name, stats);
+				return 0;
+			}
+
+			f64 written = 0.0;
+			f64 read = 0.0;
+			f64 p99 = 0.0;
+			if (!read_stat(stats, "pixels_written", &written) || !read_stat(stats, "pixels_read", &read) || !read_stat(stats, "frames_presented", &frames)
+				|| !read_stat(stats, "present_ns.p50", &presents[i]) || !read_stat(stats, "present_ns.p99", &p99)) {
+				printf("%-12s no graphics statistics in %s\n", name, stats);
+				return 0;
+			}
+
+			pixel_rates[i] = (walls[i] > 0.0) ? (written + read) / walls[i] / 1000000.0 : 0.0;
+			present_p99 = (p99 > present_p99) ? p99 : present_p99;
+		}
+	}
+
+	summary_t wall = summarize(walls, bench->runs);
+	summary_t rate = summarize(mips, bench->runs);
+	f64 cv = (rate.mean > 0.0) ? 100.0 * rate.stddev / rate.mean : 0.0;
+	if (bench->graphics) {
+		summary_t pixels = summarize(pixel_rates, bench->runs);
+		summary_t present = summarize(presents, bench->runs);
+		f64 pixels_cv = (pixels.mean > 0.0) ? 100.0 * pixels.stddev / pixels.mean : 0.0;
+		printf("%-12s %12.0f %10.4f %10.2f %12.2f %7.2f%% %8.0f %12.1f %12.1f\n", name, retired, wall.mean, rate.mean, pixels.mean, pixels_cv, frames,
+			present.mean / 1000.0, present_p99 / 1000.0);
+		if (bench->csv != NULL) {
+			fprintf(bench->csv, "%s,%.0f,%u,%.6f,%.6f,%.3f,%.3f,%.3f,%.3f,%.0f,%.0f,%.0f\n", name, retired, bench->runs, wall.mean, wall.stddev,
+				rate.mean, rate.stddev, pixels.mean, pixels.stddev, frames, present.mean, present_p99);
+		}
+		return 1;
+	}
+
+	printf("%-12s %12.0f %10.4f %10.4f %10.2f %10.2f %10.2f %7.2f%%\n", name, retired, wall.mean, wall.stddev, rate.mean, rate.min, rate.max, cv);
+
+	if (bench->csv != NULL) {
+		fprintf(bench->csv, "%s,%.0f,%u,%.6f,%.6f,%.3f,%.3f,%.3f,%.3f\n", name, retired, bench->runs, wall.mean, wall.stddev, rate.mean, rate.stddev, rate.min, rate.max);
+	}
+	return 1;
+}
+
+int main(s32 argc, char** argv) {
+	bench_t bench = { .assembler = NULL, .linker = NULL, .emulator = NULL, .out_dir = NULL, .emulator_args = NULL, .memory = "1M", .budget = "50M", .runs = 5, .csv = NULL, .graphics = 0 };
+	char* csv_file = NULL;
+	char* video_driver = NULL;
+	char** workloads = (char**) malloc(sizeof(char*) * argc);
+	u32 workload_count = 0;
+	if (workloads == NULL) {
+		printf("Failed to allocate memory\n");
+		return 1;
+	}
+
+	for (s32 i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--as") == 0 && i + 1 < argc) {
+			bench.assembler = argv[++i];
+		} else if (strcmp(argv[i], "--ld") == 0 && i + 1 < argc) {
+			bench.linker = argv[++i];
+		} else if (strcmp(argv[i], "--emu") == 0 && i + 1 < argc) {
+			bench.emulator = argv[++i];
+		} else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+			bench.out_dir = argv[++i];
+		} else if ((strcmp(argv[i], "-r") == 0 || strcmp(argv[i], "--runs") == 0) && i + 1 < argc) {
+			bench.runs = (u32) strtoul(argv[++i], NULL, 10);
+		} else if ((strcmp(argv[i], "-b") == 0 || strcmp(argv[i], "--budget") == 0) && i + 1 < argc) {
+			bench.budget = argv[++i];
+		} else if ((strcmp(argv[i], "-m") == 0 || strcmp(argv[i], "--memory") == 0) && i + 1 < argc) {
+			bench.memory = argv[++i];
+		} else if (strcmp(argv[i], "--emu-args") == 0 && i + 1 < argc) {
+			bench.emulator_args = argv[++i];
+		} else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc) {
+			csv_file = argv[++i];
+		} else if (strcmp(argv[i], "-g") == 0 || strcmp(argv[i], "--graphics") == 0) {
+			bench.graphics = 1;
+		} else if (strcmp(argv[i], "--video-driver") == 0 && i + 1 < argc) {
+			video_driver = argv[++i];
+		} else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+			print_help(argc, argv);
+			return 0;
+		} else if (argv[i][0] != '-') {
+			workloads[workload_count++] = argv[i];
+		} else {
+			printf("Unknown argument (%d): %s\n", i, argv[i]);
+			print_help(argc, argv);
+			return 1;
+		}
+	}
+
+	if (bench.assembler == NULL || bench.linker == NULL || bench.emulator == NULL || bench.out_dir == NULL || workload_count == 0) {
+		print_help(argc, argv);
+		return 1;
+	}
+
+	if (bench.runs == 0 || bench.runs > MAX_RUNS) {
+		printf("Run count must be between 1 and %u\n", MAX_RUNS);
+		return 1;
+	}
+
+	/* an explicit driver wins, otherwise an already exported SDL_VIDEODRIVER, otherwise dummy */
+	if (bench.graphics && (video_driver != NULL || getenv("SDL_VIDEODRIVER") == NULL)) {
+		video_driver = (video_driver != NULL) ? video_driver : "dummy";
+#ifdef _WIN32
+		_putenv_s("SDL_VIDEODRIVER", video_driver);
+#else
+		setenv("SDL_VIDEODRIVER", video_driver, 1);
+#endif
+	}
+
+	if (csv_file != NULL) {
+		bench.csv = fopen(csv_file, "w");
+		if (bench.csv == NULL) {
+			printf("Failed to open CSV file: %s\n", csv_file);
+			return 1;
+		}
+
+		if (bench.graphics) {
+			fprintf(bench.csv, "workload,instructions,runs,wall_mean,wall_stddev,mips_mean,mips_stddev,mpixels_mean,mpixels_stddev,frames,present_mean_ns,present_p99_ns\n");
+		} else {
+			fprintf(bench.csv, "workload,instructions,runs,wall_mean,wall_stddev,mips_mean,mips_stddev,mips_min,mips_max\n");
+		}
+	}
+
+	printf("%u runs per workload, budget %s instructions\n", bench.runs, bench.budget);
+	if (bench.graphics) {
+		printf("video driver %s, present times in microseconds\n", getenv("SDL_VIDEODRIVER"));
+		printf("%-12s %12s %10s %10s %12s %8s %8s %12s %12s\n", "workload", "instructions", "wall (s)", "MIPS", "Mpixels/s", "cv", "frames", "present p50", "present p99");
+	} else {
+		printf("%-12s %12s %10s %10s %10s %10s %10s %8s\n", "workload", "instructions", "wall (s)", "stddev", "MIPS", "min", "max", "cv");
+	}
+	u32 failed = 0;
+	for (u32 i = 0; i < workload_count; ++i) {
+		if (!bench_workload(&bench, workloads[i])) {
+			++failed;
+		}
+	}
+
+	if (bench.csv != NULL) {
+		fclose(bench.csv);
+	}
+	free(workloads);
+	return (failed == 0) ? 0 : 1;
+}
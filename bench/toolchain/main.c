@@ -0,0 +1,339 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#endif
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+
+typedef float f32;
+typedef double f64;
+
+typedef size_t usize;
+
+#ifdef _WIN32
+#define PATH_SEPARATOR '\\'
+#else
+#define PATH_SEPARATOR '/'
+#endif
+
+#define MAX_SIZES 32
+#define MAX_ARGS 16
+
+typedef struct {
+	f64 seconds;
+	/* peak resident set of the child in bytes, 0 when the platform cannot tell */
+	u64 peak_rss;
+} measurement_t;
+
+typedef struct {
+	f64 seconds;
+	f64 best_seconds;
+	u64 peak_rss;
+} result_t;
+
+void print_help(s32 argc, char** argv) {
+	printf("Usage: %s --as <k32-as> --ld <k32-ld> --gen <k32-asmgen> --out <dir> [options]\n", argv[0]);
+	printf("Flags:\n  [-n, --lines] <list> Comma separated line counts to generate (default 10K,100K,1M)\n");
+	printf("  [-r, --runs] <count> Runs of each tool per size (default 3)\n");
+	printf("  [--gen-args] <args> Extra arguments for the generator, such as '--sections 16'\n");
+	printf("  [--csv] <file> Also write one line per size to a CSV file\n");
+	printf("  [-h, --help] Print help message\n");
+}
+
+/* runs argv[0] with its output discarded, measuring wall time and the child's peak memory */
+s32 measure(char** args, measurement_t* out) {
+#ifdef _WIN32
+	char command[4096];
+	usize length = 0;
+	command[0] = '\0';
+	for (u32 i = 0; args[i] != NULL; ++i) {
+		length += snprintf(&command[length], sizeof(command) - length, "%s\"%s\"", (i == 0) ? "" : " ", args[i]);
+		if (length >= sizeof(command)) {
+			return 0;
+		}
+	}
+
+	SECURITY_ATTRIBUTES security = { .nLength = sizeof(SECURITY_ATTRIBUTES), .bInheritHandle = TRUE };
+	HANDLE null_handle = CreateFileA("NUL", GENERIC_WRITE, FILE_SHARE_WRITE, &security, OPEN_EXISTING, 0, NULL);
+	STARTUPINFOA startup = { .cb = sizeof(STARTUPINFOA), .dwFlags = STARTF_USESTDHANDLES, .hStdOutput = null_handle, .hStdError = null_handle };
+	PROCESS_INFORMATION process;
+
+	LARGE_INTEGER frequency;
+	LARGE_INTEGER start;
+	LARGE_INTEGER end;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&start);
+	if (!CreateProcessA(NULL, command, NULL, NULL, TRUE, 0, NULL, NULL, &startup, &process)) {
+		CloseHandle(null_handle);
+		return 0;
+	}
+
+	WaitForSingleObject(process.hProcess, INFINITE);
+	QueryPerformanceCounter(&end);
+
+	DWORD exit_code = 1;
+	GetExitCodeProcess(process.hProcess, &exit_code);
+	PROCESS_MEMORY_COUNTERS memory;
+	out->peak_rss = GetProcessMemoryInfo(process.hProcess, &memory, sizeof(memory)) ? (u64) memory.PeakWorkingSetSize : 0;
+	out->seconds = (f64) (end.QuadPart - start.QuadPart) / (f64) frequency.QuadPart;
+
+	CloseHandle(process.hThread);
+	CloseHandle(process.hProcess);
+	CloseHandle(null_handle);
+	return exit_code == 0;
+#else
+	struct timespec start;
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	pid_t pid = fork();
+	if (pid < 0) {
+		return 0;
+	}
+
+	if (pid == 0) {
+		s32 null_fd = open("/dev/null", O_WRONLY);
+		if (null_fd >= 0) {
+			dup2(null_fd, STDOUT_FILENO);
+			dup2(null_fd, STDERR_FILENO);
+		}
+		execv(args[0], args);
+		_exit(127);
+	}
+
+	s32 status = 0;
+	struct rusage usage;
+	if (wait4(pid, &status, 0, &usage) != pid) {
+		return 0;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	out->seconds = (f64) (end.tv_sec - start.tv_sec) + (f64) (end.tv_nsec - start.tv_nsec) / 1000000000.0;
+#ifdef __APPLE__
+	out->peak_rss = (u64) usage.ru_maxrss;
+#else
+	out->peak_rss = (u64) usage.ru_maxrss * 1024;
+#endif
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+#endif
+}
+
+u64 file_size(char* path) {
+	FILE* file = fopen(path, "rb");
+	if (file == NULL) {
+		return 0;
+	}
+
+	fseek(file, 0, SEEK_END);
+	u64 size = (u64) ftell(file);
+	fclose(file);
+	return size;
+}
+
+u64 parse_count(char* str, char** end) {
+	u64 value = strtoull(str, end, 10);
+	if (**end == 'K') {
+		value *= 1000;
+		++*end;
+	} else if (**end == 'M') {
+		value *= 1000000;
+		++*end;
+	}
+	return value;
+}
+
+s32 run_tool(char** args, u32 runs, result_t* result) {
+	result->seconds = 0.0;
+	result->best_seconds = 0.0;
+	result->peak_rss = 0;
+	for (u32 i = 0; i < runs; ++i) {
+		measurement_t m;
+		if (!measure(args, &m)) {
+			return 0;
+		}
+
+		result->seconds += m.seconds / (f64) runs;
+		result->best_seconds = (i == 0 || m.seconds < result->best_seconds) ? m.seconds : result->best_seconds;
+		result->peak_rss = (m.peak_rss > result->peak_rss) ? m.peak_rss : result->peak_rss;
+	}
+	return 1;
+}
+
+/* splits extra generator arguments on spaces, quoting is not supported */
+u32 split_args(char* str, char** args, u32 max) {
+	u32 count = 0;
+	char* token = strtok(str, " ");
+	while (token != NULL && count < max) {
+		args[count++] = token;
+		token = strtok(NULL, " ");
+	}
+	return count;
+}
+
+int main(s32 argc, char** argv) {
+	char* assembler = NULL;
+	char* linker = NULL;
+	char* generator = NULL;
+	char* out_dir = NULL;
+	char* gen_args = NULL;
+	char* csv_file = NULL;
+	char* lines_list = "10K,100K,1M";
+	u32 runs = 3;
+	for (s32 i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--as") == 0 && i + 1 < argc) {
+			assembler = argv[++i];
+		} else if (strcmp(argv[i], "--ld") == 0 && i + 1 < argc) {
+			linker = argv[++i];
+		} else if (strcmp(argv[i], "--gen") == 0 && i + 1 < argc) {
+			generator = argv[++i];
+		} else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+			out_dir = argv[++i];
+		} else if ((strcmp(argv[i], "-n") == 0 || strcmp(argv[i], "--lines") == 0) && i + 1 < argc) {
+			lines_list = argv[++i];
+		} else if ((strcmp(argv[i], "-r") == 0 || strcmp(argv[i], "--runs") == 0) && i + 1 < argc) {
+			runs = (u32) strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--gen-args") == 0 && i + 1 < argc) {
+			gen_args = argv[++i];
+		} else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc) {
+			csv_file = argv[++i];
+		} else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+			print_help(argc, argv);
+			return 0;
+		} else {
+			printf("Unknown argument (%d): %s\n", i, argv[i]);
+			print_help(argc, argv);
+			return 1;
+		}
+	}
+
+	if (assembler == NULL || linker == NULL || generator == NULL || out_dir == NULL || runs == 0) {
+		print_help(argc, argv);
+		return 1;
+	}
+
+	u64 sizes[MAX_SIZES];
+	u32 size_count = 0;
+	char* p = lines_list;
+	while (*p != '\0' && size_count < MAX_SIZES) {
+		char* end = NULL;
+		u64 lines = parse_count(p, &end);
+		if (end == p || lines == 0 || (*end != ',' && *end != '\0')) {
+			printf("Invalid line count list: %s\n", lines_list);
+			return 1;
+		}
+
+		sizes[size_count++] = lines;
+		p = (*end == ',') ? end + 1 : end;
+	}
+
+	FILE* csv = NULL;
+	if (csv_file != NULL) {
+		csv = fopen(csv_file, "w");
+		if (csv == NULL) {
+			printf("Failed to open CSV file: %s\n", csv_file);
+			return 1;
+		}
+		fprintf(csv, "lines,source_bytes,object_bytes,as_seconds,as_best_seconds,as_peak_rss,ld_seconds,ld_best_seconds,ld_peak_rss\n");
+	}
+
+	/* 'per line' is time per source line relative to the smallest size, above 1 means the tool grows superlinearly */
+	printf("%u runs per tool, times are means, memory is the peak resident set\n", runs);
+	printf("%10s %10s %10s %10s %10s %10s %10s %10s %10s\n", "lines", "source", "as (s)", "as MiB", "per line", "object", "ld (s)", "ld MiB", "per line");
+
+	f64 as_base = 0.0;
+	f64 ld_base = 0.0;
+	u32 failed = 0;
+	for (u32 i = 0; i < size_count; ++i) {
+		char source[1024];
+		char object[1024];
+		char image[1024];
+		char lines_arg[32];
+		snprintf(source, sizeof(source), "%s%cgen_%llu.asm", out_dir, PATH_SEPARATOR, (unsigned long long) sizes[i]);
+		snprintf(object, sizeof(object), "%s%cgen_%llu.o", out_dir, PATH_SEPARATOR, (unsigned long long) sizes[i]);
+		snprintf(image, sizeof(image), "%s%cgen_%llu.bin", out_dir, PATH_SEPARATOR, (unsigned long long) sizes[i]);
+		snprintf(lines_arg, sizeof(lines_arg), "%llu", (unsigned long long) sizes[i]);
+
+		char extra[1024] = { 0 };
+		char* args[MAX_ARGS + 8] = { generator, "-n", lines_arg, "-o", source };
+		u32 arg_count = 5;
+		if (gen_args != NULL) {
+			snprintf(extra, sizeof(extra), "%s", gen_args);
+			arg_count += split_args(extra, &args[arg_count], MAX_ARGS);
+		}
+		args[arg_count] = NULL;
+
+		measurement_t generated;
+		if (!measure(args, &generated)) {
+			printf("%10llu generator failed\n", (unsigned long long) sizes[i]);
+			++failed;
+			continue;
+		}
+
+		char* as_args[] = { assembler, source, "-o", object, NULL };
+		result_t as_result;
+		if (!run_tool(as_args, runs, &as_result)) {
+			printf("%10llu assembler failed\n", (unsigned long long) sizes[i]);
+			++failed;
+			continue;
+		}
+
+		char* ld_args[] = { linker, object, "-o", image, "--base", "0", NULL };
+		result_t ld_result;
+		if (!run_tool(ld_args, runs, &ld_result)) {
+			printf("%10llu linker failed\n", (unsigned long long) sizes[i]);
+			++failed;
+			continue;
+		}
+
+		f64 as_per_line = as_result.seconds / (f64) sizes[i];
+		f64 ld_per_line = ld_result.seconds / (f64) sizes[i];
+		if (as_base == 0.0) {
+			as_base = as_per_line;
+			ld_base = ld_per_line;
+		}
+
+		u64 source_size = file_size(source);
+		u64 object_size = file_size(object);
+		printf("%10llu %9.1fM %10.3f %10.1f %9.2fx %9.1fM %10.3f %10.1f %9.2fx\n", (unsigned long long) sizes[i], (f64) source_size / 1048576.0,
+			as_result.seconds, (f64) as_result.peak_rss / 1048576.0, (as_base > 0.0) ? as_per_line / as_base : 0.0,
+			(f64) object_size / 1048576.0, ld_result.seconds, (f64) ld_result.peak_rss / 1048576.0, (ld_base > 0.0) ? ld_per_line / ld_base : 0.0);
+		fflush(stdout);
+
+		if (csv != NULL) {
+			fprintf(csv, "%llu,%llu,%llu,%.6f,%.6f,%llu,%.6f,%.6f,%llu\n", (unsigned long long) sizes[i], (unsigned long long) source_size,
+				(unsigned long long) object_size, as_result.seconds, as_result.best_seconds, (unsigned long long) as_result.peak_rss,
+				ld_result.seconds, ld_result.best_seconds, (unsigned long long) ld_result.peak_rss);
+		}
+	}
+
+	if (csv != NULL) {
+		fclose(csv);
+	}
+	return (failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,20 @@
+// integer arithmetic and logic, no memory traffic
+.text
+
+start:
+    ldi sp, 0x10000
+    ldi r1, 1
+    ldi r2, 3
+    ldi r3, 0x0F0F0F0F
+
+    loop:
+        add r4, r4, r2
+        sub r5, r5, r1
+        xor r6, r4, r5
+        and r7, r6, r3
+        or r8, r7, r2
+        shl r9, r4, r1
+        shr r10, r9, r2
+        not r11, r10
+        add r12, r11, r8
+        jmpi loop
@@ -0,0 +1,55 @@
+// four state machine driven by a xorshift32 bit stream, mostly unpredictable branches
+.text
+
+start:
+    ldi sp, 0x10000
+    ldi r1, 1
+    ldi r2, 2
+    ldi r5, 0x2545F491
+    ldi r11, 5
+    ldi r12, 17
+    ldi r13, 13
+    ldi r0, 0
+
+    loop:
+        shl r6, r5, r13
+        xor r5, r5, r6
+        shr r6, r5, r12
+        xor r5, r5, r6
+        shl r6, r5, r11
+        xor r5, r5, r6
+        and r7, r5, r1
+
+        jzi r0, state_a
+        sub r8, r0, r1
+        jzi r8, state_b
+        sub r8, r0, r2
+        jzi r8, state_c
+
+        // state d: 1 -> a, 0 -> d
+        jzi r7, loop
+        ldi r0, 0
+        jmpi loop
+
+    // state a: 1 -> b, 0 -> a
+    state_a:
+        jzi r7, loop
+        ldi r0, 1
+        jmpi loop
+
+    // state b: 1 -> c, 0 -> a
+    state_b:
+        jnzi r7, state_b_one
+        ldi r0, 0
+        jmpi loop
+
+        state_b_one:
+            ldi r0, 2
+            jmpi loop
+
+    // state c: 1 -> b, 0 -> d
+    state_c:
+        ldi r0, 3
+        jzi r7, loop
+        ldi r0, 1
+        jmpi loop
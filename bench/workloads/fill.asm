@@ -0,0 +1,50 @@
+// full-screen fills through a putpixel in the style of test/test.asm
+// headless runs have no framebuffer, so this measures the call and store path and not the pixel conversion
+.text
+
+start:
+    ldi sp, 0x10000
+    ldi r0, putpixel
+    ldi r1, 1
+    ldi r11, 120
+    ldi r12, 80
+    ldi r8, 0
+
+    frame:
+        ldi r10, 0
+
+        row:
+            ldi r9, 0
+
+            column:
+                link r0
+                add r9, r9, r1
+                sub r13, r9, r11
+                jnzi r13, column
+
+            add r10, r10, r1
+            sub r13, r10, r12
+            jnzi r13, row
+
+        add r8, r8, r1
+        jmpi frame
+
+// r8 color, r9 x, r10 y
+putpixel:
+    push r15
+    push r14
+    push r10
+
+    ldi r15, 0xF0000000
+    add r15, r15, r9
+
+    ldi r14, 120
+    mul r10, r10, r14
+
+    add r15, r15, r10
+    str8 r15, r8
+
+    pop r10
+    pop r14
+    pop r15
+    ret
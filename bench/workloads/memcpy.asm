@@ -0,0 +1,32 @@
+// byte memset of a 4K buffer followed by a byte memcpy of it
+.text
+
+start:
+    ldi sp, 0x10000
+    ldi r1, 1
+    ldi r4, 0xA5
+
+    loop:
+        ldi r2, 0x1000
+        ldi r3, 0x1000
+
+        memset_loop:
+            str8 r2, r4
+            add r2, r2, r1
+            sub r3, r3, r1
+            jnzi r3, memset_loop
+
+        ldi r2, 0x1000
+        ldi r5, 0x3000
+        ldi r3, 0x1000
+
+        memcpy_loop:
+            ldm8 r6, r2
+            str8 r5, r6
+            add r2, r2, r1
+            add r5, r5, r1
+            sub r3, r3, r1
+            jnzi r3, memcpy_loop
+
+        add r4, r4, r1
+        jmpi loop
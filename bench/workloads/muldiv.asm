@@ -0,0 +1,19 @@
+// mul, div and rem with a divisor that never reaches zero
+.text
+
+start:
+    ldi sp, 0x10000
+    ldi r1, 7
+    ldi r2, 1
+    ldi r3, 0x12345
+
+    loop:
+        add r3, r3, r2
+        mul r4, r3, r1
+        div r5, r4, r1
+        rem r6, r3, r1
+        mul r7, r5, r6
+        add r8, r6, r2
+        div r9, r4, r8
+        rem r10, r4, r8
+        jmpi loop
@@ -0,0 +1,33 @@
+// naive recursive fibonacci, dominated by link/ret and push/pop
+.text
+
+start:
+    ldi sp, 0x10000
+    ldi r14, fib
+    ldi r1, 1
+    ldi r2, 2
+
+    loop:
+        ldi r0, 20
+        link r14
+        jmpi loop
+
+// r0 n, returns fib(n) in r0, clobbers r3
+fib:
+    jzi r0, fib_done
+    sub r3, r0, r1
+    jzi r3, fib_done
+
+    push r0
+    sub r0, r0, r1
+    link r14
+    pop r3
+
+    push r0
+    sub r0, r3, r2
+    link r14
+    pop r3
+    add r0, r0, r3
+
+    fib_done:
+        ret
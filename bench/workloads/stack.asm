@@ -0,0 +1,26 @@
+// push/pop storm eight registers deep
+.text
+
+start:
+    ldi sp, 0x10000
+    ldi r1, 1
+
+    loop:
+        push r0
+        push r1
+        push r2
+        push r3
+        push r4
+        push r5
+        push r6
+        push r7
+        pop r7
+        pop r6
+        pop r5
+        pop r4
+        pop r3
+        pop r2
+        pop r1
+        pop r0
+        add r0, r0, r1
+        jmpi loop
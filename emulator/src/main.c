@@ -3,6 +3,14 @@
 #include <string.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <signal.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
 
 #include <SDL2/SDL.h>
 
@@ -64,18 +72,272 @@ typedef struct {
     } keystate;
 } mapped_t;
 
+typedef enum {
+	PMU_EVENT_NONE = 0x00,
+	PMU_EVENT_RETIRED = 0x01,
+	PMU_EVENT_LOAD = 0x02,
+	PMU_EVENT_STORE = 0x03,
+	PMU_EVENT_BRANCH_TAKEN = 0x04,
+	PMU_EVENT_MMIO = 0x05,
+	PMU_EVENT_INTERRUPT = 0x06,
+	PMU_EVENT_COUNT,
+} pmu_event_t;
+
+#define PMU_COUNTER_COUNT 4
+
+typedef struct {
+	u32 value;
+	u8 event;
+	u8 interrupt_on_overflow;
+} pmu_counter_t;
+
+typedef struct {
+	pmu_counter_t counters[PMU_COUNTER_COUNT];
+	/* per event, bitmask of the counters selecting it */
+	u8 event_mask[PMU_EVENT_COUNT];
+	u32 overflow;
+	u32 pending;
+} pmu_t;
+
+typedef enum {
+	ACCESS_LOAD,
+	ACCESS_STORE,
+	ACCESS_KIND_COUNT,
+} access_kind_t;
+
+typedef enum {
+	ACCESS_REGION_RAM,
+	ACCESS_REGION_FRAMEBUFFER,
+	ACCESS_REGION_KEYINPUT,
+	ACCESS_REGION_OUT_OF_RANGE,
+	ACCESS_REGION_COUNT,
+} access_region_t;
+
+typedef struct {
+	s32 enabled;
+	u64 opcodes[256];
+	/* indexed by kind, width (8, 16, 32) and region */
+	u64 accesses[ACCESS_KIND_COUNT][3][ACCESS_REGION_COUNT];
+	u64 interrupts[256];
+	u64 interrupts_ignored;
+	u64 exceptions[256];
+	SDL_atomic_t frames;
+	u64 pixels_written;
+	u64 pixels_read;
+	char video_driver[32];
+} stats_t;
+
+typedef struct {
+	s32 enabled;
+	u32 granule_shift;
+	u32 granule_count;
+	u64* loads;
+	u64* stores;
+	/* granules touched since the last working set sample */
+	u8* touched;
+	u32 touched_count;
+	u64 sample_interval;
+	u64 next_sample;
+	u32* samples;
+	usize sample_count;
+	usize sample_capacity;
+	u32 stack_lowest;
+	u32 stack_highest;
+} heatmap_t;
+
+typedef enum {
+	CACHE_INSTRUCTION,
+	CACHE_DATA,
+	CACHE_TLB,
+	CACHE_KIND_COUNT,
+} cache_kind_t;
+
+typedef struct {
+	s32 enabled;
+	u32 set_count;
+	u32 ways;
+	u32 line_shift;
+	/* set_count * ways line numbers, each set ordered from most to least recently used */
+	u32* tags;
+	u64 hits;
+	u64 misses;
+} cache_t;
+
+typedef struct {
+	u32 address;
+	u64 hits[CACHE_KIND_COUNT];
+	u64 misses[CACHE_KIND_COUNT];
+} cache_bucket_t;
+
+typedef struct {
+	s32 enabled;
+	cache_t caches[CACHE_KIND_COUNT];
+	/* shadow call stack of link and interrupt targets, the innermost last */
+	u32 call_stack[0x100];
+	u32 call_depth;
+	/* per function buckets keyed on the entry address, found through an open addressed index */
+	cache_bucket_t* functions;
+	u32 function_count;
+	u32 function_capacity;
+	u32* function_slots;
+	u32 current_function;
+	/* fixed size address ranges */
+	cache_bucket_t* ranges;
+	u32 range_count;
+} cache_model_t;
+
+/* log-linear: 8 linear sub-buckets per power of two, about 12% resolution */
+#define HISTOGRAM_SUB_BITS 3
+#define HISTOGRAM_BUCKET_COUNT (64 << HISTOGRAM_SUB_BITS)
+
+typedef struct {
+	u64 counts[HISTOGRAM_BUCKET_COUNT];
+	u64 count;
+	u64 max;
+} histogram_t;
+
+#define LATENCY_HANDLER_DEPTH 16
+
+typedef struct {
+	s32 enabled;
+	s32 overlay;
+	/* host counter time the key event being delivered arrived at SDL, 0 when none */
+	u64 pending_arrival;
+	/* entered handlers, closed by the ret that pops the stack back above the pushed ip */
+	struct {
+		u64 entered;
+		u32 sp;
+	} handlers[LATENCY_HANDLER_DEPTH];
+	u32 handler_depth;
+	/* histograms are in nanoseconds, present and frame_interval are owned by the timer thread */
+	histogram_t input;
+	histogram_t handler;
+	histogram_t present;
+	histogram_t frame_interval;
+	u64 last_frame;
+	SDL_atomic_t last_present_us;
+	SDL_atomic_t last_interval_us;
+} latency_t;
+
+/* on-disk tracepoint record, must match trace/src/main.c */
+typedef struct {
+	u64 retired;
+	u32 id;
+	u32 payload[4];
+	/* records lost to a full ring immediately before this one, saturating */
+	u32 dropped_before;
+} trace_record_t;
+
+/* single producer (the cpu) single consumer (the flush thread) ring, capacity a power of two */
+#define TRACE_RING_SIZE 0x10000
+
+typedef struct {
+	s32 enabled;
+	trace_record_t* ring;
+	/* free running indices, head written only by the cpu and tail only by the flush thread */
+	SDL_atomic_t head;
+	SDL_atomic_t tail;
+	SDL_atomic_t stop;
+	u32 dropped_pending;
+	u64 dropped;
+	u64 written;
+	FILE* file;
+	SDL_Thread* thread;
+} trace_t;
+
+typedef struct {
+	u32 cost[256];
+	u64 clock_hz;
+	u64 pace_counter;
+	u64 pace_cycles;
+} timing_t;
+
 typedef struct {
 	registers_t regs;
 	memory_t memory;
+	/* where the ROM is loaded and execution starts, BOOT_VECTOR unless --load moves it */
+	u32 boot_vector;
 	interrupts_t interrupts;
 
 	cpu_mode_t mode;
 	s32 halt;
+
+	u64 cycles;
+	u64 retired;
+	/* any per-instruction hook is on, kept current by update_instrumented so a plain run tests one flag */
+	s32 instrumented;
+	/* --stats or --live-stats report the idle ratio */
+	s32 track_idle;
+	/* instructions that jumped to themselves, i.e. the guest spinning while it waits */
+	u64 idle_spins;
+	u64 interrupts_taken;
+	timing_t timing;
+	pmu_t pmu;
+	stats_t stats;
+	heatmap_t heatmap;
+	cache_model_t cache;
+	latency_t latency;
+	trace_t trace;
     
     graphical_t graphical;
     mapped_t mapped;
 } cpu_t;
 
+/* layout written by k32-ld --sparse, bump SPARSE_VERSION in both when it changes */
+#define SPARSE_MAGIC "K32S"
+#define SPARSE_VERSION 1
+
+typedef struct {
+	u8 magic[4];
+	u16 version;
+	u16 segment_count;
+	u32 entry;
+	u32 reserved;
+} sparse_header_t;
+
+/* bytes past file_size up to memory_size are left zero */
+typedef struct {
+	u32 address;
+	u32 offset;
+	u32 file_size;
+	u32 memory_size;
+} sparse_segment_t;
+
+/* layout shared with k32-top, bump LIVE_STATS_VERSION when it changes */
+#define LIVE_STATS_MAGIC 0x4C32334B
+#define LIVE_STATS_VERSION 1
+
+typedef struct {
+	u32 magic;
+	u32 version;
+	/* odd while the emulator is writing, readers retry until it is even and unchanged */
+	volatile u32 sequence;
+	u32 pid;
+	u64 started_time;
+	u64 updated_time;
+	u64 retired;
+	u64 cycles;
+	u64 frames;
+	u64 interrupts;
+	f64 mips;
+	f64 interrupt_rate;
+	f64 idle_ratio;
+	u64 rss;
+	u32 halted;
+	u32 graphical;
+	char rom[64];
+} live_stats_t;
+
+typedef struct {
+	live_stats_t* shared;
+	char name[64];
+	u64 last_publish;
+	u64 window_counter;
+	u64 window_retired;
+	u64 window_interrupts;
+	u64 window_idle_spins;
+} live_t;
+
 typedef enum {
 	EXCEPTION_DIVIDE_BY_ZERO = 0x00,
 	EXCEPTION_INVALID_INSTRUCTION = 0x01,
@@ -98,18 +360,88 @@ typedef enum {
 #define KEYINPUT_SIZE 0x02
 
 #define KEYINTERRUPT 0x01
+#define PMUINTERRUPT 0x05
+
+/* how many retired instructions between checks against the --clock-hz pace */
+#define PACE_INTERVAL 0x400
+/* how far behind the pace the guest may fall before the pace is reset instead of caught up */
+#define PACE_MAX_LAG 0.1
+
+/* main loop iterations between checks of the live stats publish interval */
+#define LIVE_STATS_INTERVAL 0x4000
+#define LIVE_STATS_HZ 10
+
+#define HEATMAP_MAGIC 0x4832334B
+#define HEATMAP_VERSION 1
+#define HEATMAP_GRANULE 0x1000
+#define HEATMAP_SAMPLE_INTERVAL 100000
+#define HEATMAP_HOT_COUNT 10
+
+#define CACHE_RANGE_SHIFT 12
+#define CACHE_REPORT_COUNT 16
+
+#define LATENCY_OVERLAY_HZ 2
+
+#define TRACE_MAGIC 0x5432334B
+#define TRACE_VERSION 1
+/* how long the flush thread sleeps when the ring is empty */
+#define TRACE_FLUSH_MS 10
 
 #define FETCH_U16(data, offset) (*((u16*) &data[offset]))
 #define FETCH_U32(data, offset) (*((u32*) &data[offset]))
 
+#define PMU_COUNT(cpu, event) do { if ((cpu)->pmu.event_mask[event] != 0) { pmu_count(cpu, event); } } while (0)
+
 s32 issue_opcode(cpu_t* cpu, u8 opcode);
+s32 run_uninstrumented(cpu_t* cpu, u64 count, u64* executed);
+void update_instrumented(cpu_t* cpu);
 u32* get_register(cpu_t* cpu, u8 reg);
 void print_next_instruction(cpu_t* cpu);
+s32 load_timing(cpu_t* cpu, char* path);
+s32 load_rom(cpu_t* cpu, char* path, s32 load_set);
+void pmu_count(cpu_t* cpu, pmu_event_t event);
+void record_access(cpu_t* cpu, access_kind_t kind, u32 address, u8 size, access_region_t region);
+s32 write_stats(cpu_t* cpu, char* path, f64 wall_seconds);
+s32 heatmap_init(cpu_t* cpu, u32 granule, u64 sample_interval);
+void heatmap_sample(cpu_t* cpu);
+s32 heatmap_write(cpu_t* cpu, char* path);
+s32 cache_init(cpu_t* cpu, cache_kind_t kind, char* geometry);
+s32 cache_model_init(cpu_t* cpu);
+void cache_access(cpu_t* cpu, cache_kind_t kind, u32 address, u32 size);
+void cache_enter(cpu_t* cpu, u32 address);
+void cache_leave(cpu_t* cpu);
+void cache_report(cpu_t* cpu);
+void histogram_add(histogram_t* histogram, u64 value);
+u64 counter_to_ns(u64 ticks);
+s32 trace_open(cpu_t* cpu, char* path);
+void trace_close(cpu_t* cpu);
+void latency_enter(cpu_t* cpu);
+void latency_leave(cpu_t* cpu);
+void latency_report(cpu_t* cpu);
+void latency_overlay(cpu_t* cpu, char* title);
+u64 histogram_percentile(histogram_t* histogram, f64 fraction);
 
 void print_help(s32 argc, char** argv) {
 	printf("Usage: %s <rom file> [options]\n", argv[0]);
 	printf("Flags:\n  [-p, --print-status] [/Ps] Print the status of the processor after each instruction\n");
 	printf("  [-m, --memory] [/M] Set emulator memory size (example: 12M or 100K or 9G)\n");
+	printf("  [--load] [/Ld] Load the ROM at this address and start executing there, match the k32-ld --base it was linked with (example: 0x10000)\n");
+	printf("                 Images written by k32-ld --sparse carry their own addresses and are loaded segment by segment\n");
+	printf("  [-t, --timing] [/T] Load per-opcode cycle costs from a file (lines of '<mnemonic or 0xNN> <cycles>')\n");
+	printf("  [--clock-hz] [/Hz] Pace execution to a target clock speed in cycles per second (example: 4M)\n");
+	printf("  [--turbo] [/Tu] Run as fast as possible, ignoring --clock-hz\n");
+	printf("  [--max-instructions] [/Mi] Stop after retiring this many instructions (example: 50M)\n");
+	printf("  [-s, --stats] [/S] Write execution statistics as JSON to a file at exit\n");
+	printf("  [-l, --live-stats] [/L] Publish live counters to shared memory for k32-top\n");
+	printf("  [--heatmap] [/Hm] Record per-granule load/store counts and working set, write a binary heatmap to a file at exit\n");
+	printf("  [--heatmap-granule] [/Hg] Heatmap granule size in bytes, a power of two (default 4096)\n");
+	printf("  [--heatmap-interval] [/Hi] Instructions between working set samples (default 100K)\n");
+	printf("  [--icache] [/Ic] Simulate an LRU instruction cache, <size>:<ways>:<line bytes> (example: 8K:2:32, K is 1024)\n");
+	printf("  [--dcache] [/Dc] Simulate an LRU data cache, <size>:<ways>:<line bytes>\n");
+	printf("  [--tlb] [/Tlb] Simulate an LRU TLB shared by fetches and data, <entries>:<ways>:<page bytes> (example: 64:4:4K)\n");
+	printf("  [--latency] [/Lt] Measure input-to-handler latency, guest handler time and frame present cost, report at exit\n");
+	printf("  [--latency-overlay] [/Lo] Like --latency, and show the current figures in the window title\n");
+	printf("  [--trace] [/Tr] Write guest tracepoints (sys 0x0B) to a binary log, decode it with k32-trace\n");
     printf("  [-h, --help] [/H] Print help message\n");
 }
 
@@ -121,11 +453,188 @@ u32 decchar_to_u32(char c) {
 	return c - '0';
 }
 
+/* decimal number with an optional K, M or G multiplier suffix */
+s32 parse_scaled(char* str, u64* out) {
+    u64 mult = 1;
+    u64 number = 0;
+    for (usize j = 0; j < strlen(str); ++j) {
+        char c = str[j];
+        if (!is_decimal(c)) {
+            if (c == 'K') {
+                mult = 1000;
+            } else if (c == 'M') {
+                mult = 1000000;
+            } else if (c == 'G') {
+                mult = 1000000000;
+            } else {
+                return 0;
+            }
+            break;
+        }
+
+        number = number * 10 + decchar_to_u32(c);
+    }
+
+    *out = mult * number;
+    return 1;
+}
+
+u64 read_rss(void) {
+#ifdef __linux__
+    FILE* file = fopen("/proc/self/statm", "r");
+    if (file == NULL) {
+        return 0;
+    }
+
+    unsigned long size = 0;
+    unsigned long resident = 0;
+    if (fscanf(file, "%lu %lu", &size, &resident) != 2) {
+        resident = 0;
+    }
+
+    fclose(file);
+    return (u64) resident * (u64) sysconf(_SC_PAGESIZE);
+#else
+    return 0;
+#endif
+}
+
+s32 live_open(live_t* live, cpu_t* cpu, char* rom_file) {
+#ifdef _WIN32
+    printf("Live stats are not supported on this platform\n");
+    return 0;
+#else
+    snprintf(live->name, sizeof(live->name), "/k32-emu.%d", (s32) getpid());
+    s32 fd = shm_open(live->name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0) {
+        printf("Failed to create shared memory segment: %s\n", live->name);
+        return 0;
+    }
+
+    if (ftruncate(fd, sizeof(live_stats_t)) != 0) {
+        printf("Failed to size shared memory segment: %s\n", live->name);
+        close(fd);
+        shm_unlink(live->name);
+        return 0;
+    }
+
+    void* p = mmap(NULL, sizeof(live_stats_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        printf("Failed to map shared memory segment: %s\n", live->name);
+        shm_unlink(live->name);
+        return 0;
+    }
+
+    live->shared = (live_stats_t*) p;
+    live->shared->pid = (u32) getpid();
+    live->shared->started_time = (u64) time(NULL);
+    live->shared->graphical = cpu->graphical.window != NULL;
+    snprintf(live->shared->rom, sizeof(live->shared->rom), "%s", rom_file);
+    live->shared->version = LIVE_STATS_VERSION;
+    SDL_MemoryBarrierRelease();
+    live->shared->magic = LIVE_STATS_MAGIC;
+
+    live->last_publish = SDL_GetPerformanceCounter();
+    live->window_counter = live->last_publish;
+    return 1;
+#endif
+}
+
+/* never blocks: a reader that races with the update sees an odd sequence and retries on its side */
+void live_publish(live_t* live, cpu_t* cpu) {
+    u64 now = SDL_GetPerformanceCounter();
+    u64 frequency = SDL_GetPerformanceFrequency();
+    if (now - live->last_publish < frequency / LIVE_STATS_HZ) {
+        return;
+    }
+    live->last_publish = now;
+
+    live_stats_t* shared = live->shared;
+    ++shared->sequence;
+    SDL_MemoryBarrierRelease();
+
+    if (now - live->window_counter >= frequency) {
+        f64 seconds = (f64) (now - live->window_counter) / (f64) frequency;
+        u64 retired = cpu->retired - live->window_retired;
+        shared->mips = (f64) retired / seconds / 1000000.0;
+        shared->interrupt_rate = (f64) (cpu->interrupts_taken - live->window_interrupts) / seconds;
+        shared->idle_ratio = (retired != 0) ? (f64) (cpu->idle_spins - live->window_idle_spins) / (f64) retired : 0.0;
+        shared->rss = read_rss();
+
+        live->window_counter = now;
+        live->window_retired = cpu->retired;
+        live->window_interrupts = cpu->interrupts_taken;
+        live->window_idle_spins = cpu->idle_spins;
+    }
+
+    shared->updated_time = (u64) time(NULL);
+    shared->retired = cpu->retired;
+    shared->cycles = cpu->cycles;
+    shared->frames = (u64) SDL_AtomicGet(&cpu->stats.frames);
+    shared->interrupts = cpu->interrupts_taken;
+    shared->halted = (u32) cpu->halt;
+
+    SDL_MemoryBarrierRelease();
+    ++shared->sequence;
+}
+
+void live_close(live_t* live) {
+#ifndef _WIN32
+    munmap(live->shared, sizeof(live_stats_t));
+    shm_unlink(live->name);
+#endif
+    live->shared = NULL;
+}
+
+void pace_execution(cpu_t* cpu) {
+    u64 now = SDL_GetPerformanceCounter();
+    f64 elapsed = (f64) (now - cpu->timing.pace_counter) / (f64) SDL_GetPerformanceFrequency();
+    f64 target = (f64) (cpu->cycles - cpu->timing.pace_cycles) / (f64) cpu->timing.clock_hz;
+
+    if (target > elapsed) {
+        u32 ms = (u32) ((target - elapsed) * 1000.0);
+        if (ms > 0) {
+            SDL_Delay(ms);
+        }
+    } else if (elapsed - target > PACE_MAX_LAG) {
+        cpu->timing.pace_counter = now;
+        cpu->timing.pace_cycles = cpu->cycles;
+    }
+}
+
 Uint32 timer_callback(Uint32 interval, void* param) {
-    SDL_UpdateWindowSurface(param);
+    cpu_t* cpu = (cpu_t*) param;
+    if (!cpu->latency.enabled) {
+        SDL_UpdateWindowSurface(cpu->graphical.window);
+        SDL_AtomicAdd(&cpu->stats.frames, 1);
+        return interval;
+    }
+
+    latency_t* latency = &cpu->latency;
+    u64 start = SDL_GetPerformanceCounter();
+    SDL_UpdateWindowSurface(cpu->graphical.window);
+    SDL_AtomicAdd(&cpu->stats.frames, 1);
+    u64 end = SDL_GetPerformanceCounter();
+
+    u64 present = counter_to_ns(end - start);
+    histogram_add(&latency->present, present);
+    SDL_AtomicSet(&latency->last_present_us, (int) (present / 1000));
+    if (latency->last_frame != 0) {
+        u64 frame = counter_to_ns(start - latency->last_frame);
+        histogram_add(&latency->frame_interval, frame);
+        SDL_AtomicSet(&latency->last_interval_us, (int) (frame / 1000));
+    }
+
+    latency->last_frame = start;
     return interval;
 }
 
+volatile sig_atomic_t interrupted = 0;
+void handle_signal(s32 signal) {
+    interrupted = 1;
+}
+
 #define SCANCODE_FROM_SDL_SIMPLE(name) case SDL_SCANCODE_##name: return 'name';
 #define SCANCODE_FROM_SDL(sdl, value) case SDL_SCANCODE_##sdl: return value;
 
@@ -231,35 +740,105 @@ s32 main(s32 argc, char** argv) {
 	}
 
     u32 memory_size = MEMORY_SIZE;
+    u32 load_address = BOOT_VECTOR;
+    s32 load_set = 0;
     s32 is_graphical = 0;
+    char* title = NULL;
+    char* timing_file = NULL;
+    u64 clock_hz = 0;
+    s32 turbo = 0;
+    char* stats_file = NULL;
+    s32 live_stats = 0;
+    char* heatmap_file = NULL;
+    u32 heatmap_granule = HEATMAP_GRANULE;
+    u64 heatmap_interval = HEATMAP_SAMPLE_INTERVAL;
+    char* cache_geometry[CACHE_KIND_COUNT] = { NULL, NULL, NULL };
+    s32 latency = 0;
+    char* trace_file = NULL;
+    u64 max_instructions = 0;
 	for (s32 i = 1; i < argc; ++i) {
 		if (strcmp(argv[i], "-p") == 0 || strcmp(argv[i], "--print-status") == 0 || strcmp(argv[i], "/Ps") == 0) {
 			print_status = 1;
 		} else if ((strcmp(argv[i], "-m") == 0 || strcmp(argv[i], "--memory") == 0 || strcmp(argv[i], "/M") == 0) && i + 1 < argc) {
-            u32 mult = 1;
-            u32 number = 0;
-            for (usize j = 0; j < strlen(argv[i + 1]); ++j) {
-                char c = argv[i + 1][j];
-                if (!is_decimal(c)) {
-                    if (c == 'K') {
-                        mult = 1000;
-                    } else if (c == 'M') {
-                        mult = 1000000;
-                    } else if (c == 'G') {
-                        mult = 1000000000;
-                    } else {
-			            printf("Unknown argument (%d): %s\n", i + 1, argv[i + 1]);
-                        print_help(argc, argv);
-            			return 1;
-                    }
-                    break;
-                }
-
-                number = number * 10 + decchar_to_u32(c);
+            u64 value = 0;
+            if (!parse_scaled(argv[i + 1], &value)) {
+	            printf("Unknown argument (%d): %s\n", i + 1, argv[i + 1]);
+                print_help(argc, argv);
+            	return 1;
             }
             
             ++i;
-            memory_size = mult * number;
+            memory_size = (u32) value;
+        } else if ((strcmp(argv[i], "--load") == 0 || strcmp(argv[i], "/Ld") == 0) && i + 1 < argc) {
+            char* end = NULL;
+            u64 value = strtoull(argv[i + 1], &end, 0);
+            if (end == argv[i + 1] || *end != '\0' || value > 0xFFFFFFFF) {
+	            printf("Unknown argument (%d): %s\n", i + 1, argv[i + 1]);
+                print_help(argc, argv);
+            	return 1;
+            }
+
+            ++i;
+            load_address = (u32) value;
+            load_set = 1;
+        } else if ((strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "--timing") == 0 || strcmp(argv[i], "/T") == 0) && i + 1 < argc) {
+            timing_file = argv[i + 1];
+            ++i;
+        } else if ((strcmp(argv[i], "--clock-hz") == 0 || strcmp(argv[i], "/Hz") == 0) && i + 1 < argc) {
+            if (!parse_scaled(argv[i + 1], &clock_hz)) {
+	            printf("Unknown argument (%d): %s\n", i + 1, argv[i + 1]);
+                print_help(argc, argv);
+            	return 1;
+            }
+            ++i;
+        } else if (strcmp(argv[i], "--turbo") == 0 || strcmp(argv[i], "/Tu") == 0) {
+            turbo = 1;
+        } else if ((strcmp(argv[i], "--max-instructions") == 0 || strcmp(argv[i], "/Mi") == 0) && i + 1 < argc) {
+            if (!parse_scaled(argv[i + 1], &max_instructions)) {
+	            printf("Unknown argument (%d): %s\n", i + 1, argv[i + 1]);
+                print_help(argc, argv);
+            	return 1;
+            }
+            ++i;
+        } else if ((strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "--stats") == 0 || strcmp(argv[i], "/S") == 0) && i + 1 < argc) {
+            stats_file = argv[i + 1];
+            ++i;
+        } else if (strcmp(argv[i], "-l") == 0 || strcmp(argv[i], "--live-stats") == 0 || strcmp(argv[i], "/L") == 0) {
+            live_stats = 1;
+        } else if ((strcmp(argv[i], "--heatmap") == 0 || strcmp(argv[i], "/Hm") == 0) && i + 1 < argc) {
+            heatmap_file = argv[i + 1];
+            ++i;
+        } else if ((strcmp(argv[i], "--heatmap-granule") == 0 || strcmp(argv[i], "/Hg") == 0) && i + 1 < argc) {
+            u64 value = 0;
+            if (!parse_scaled(argv[i + 1], &value) || value == 0 || value > 0x80000000 || (value & (value - 1)) != 0) {
+                printf("Heatmap granule must be a power of two: %s\n", argv[i + 1]);
+                return 1;
+            }
+            heatmap_granule = (u32) value;
+            ++i;
+        } else if ((strcmp(argv[i], "--icache") == 0 || strcmp(argv[i], "/Ic") == 0) && i + 1 < argc) {
+            cache_geometry[CACHE_INSTRUCTION] = argv[i + 1];
+            ++i;
+        } else if ((strcmp(argv[i], "--dcache") == 0 || strcmp(argv[i], "/Dc") == 0) && i + 1 < argc) {
+            cache_geometry[CACHE_DATA] = argv[i + 1];
+            ++i;
+        } else if (strcmp(argv[i], "--latency") == 0 || strcmp(argv[i], "/Lt") == 0) {
+            latency = (latency > 1) ? latency : 1;
+        } else if (strcmp(argv[i], "--latency-overlay") == 0 || strcmp(argv[i], "/Lo") == 0) {
+            latency = 2;
+        } else if ((strcmp(argv[i], "--trace") == 0 || strcmp(argv[i], "/Tr") == 0) && i + 1 < argc) {
+            trace_file = argv[i + 1];
+            ++i;
+        } else if ((strcmp(argv[i], "--tlb") == 0 || strcmp(argv[i], "/Tlb") == 0) && i + 1 < argc) {
+            cache_geometry[CACHE_TLB] = argv[i + 1];
+            ++i;
+        } else if ((strcmp(argv[i], "--heatmap-interval") == 0 || strcmp(argv[i], "/Hi") == 0) && i + 1 < argc) {
+            if (!parse_scaled(argv[i + 1], &heatmap_interval) || heatmap_interval == 0) {
+	            printf("Unknown argument (%d): %s\n", i + 1, argv[i + 1]);
+                print_help(argc, argv);
+            	return 1;
+            }
+            ++i;
         } else if (strcmp(argv[i], "-g") == 0 || strcmp(argv[i], "--graphical") == 0 || strcmp(argv[i], "/G") == 0) {
             is_graphical = 1;
         } else if (rom_file == NULL) {
@@ -285,6 +864,7 @@ s32 main(s32 argc, char** argv) {
 	cpu_t cpu = { 0 };
 	cpu.memory.size = memory_size;
 	cpu.memory.data = (u8*) malloc(memory_size);
+	cpu.boot_vector = load_address;
     cpu.graphical.window = NULL;
     cpu.interrupts.handler_address = 0xFFFFFFFF;
 	if (cpu.memory.data == NULL) {
@@ -292,32 +872,42 @@ s32 main(s32 argc, char** argv) {
 		return 1;
 	}
 
+	/* loaded first since a sparse image moves the boot vector everything below starts from */
 	memset(cpu.memory.data, 0, memory_size);
-	{
-		FILE* file = fopen(rom_file, "rb");
-		if (file == NULL) {
-			printf("Failed to open file: %s\n", rom_file);
-			return 1;
-		}
+	if (!load_rom(&cpu, rom_file, load_set)) {
+		return 1;
+	}
 
-		usize rom_size = 0;
-		fseek(file, 0, SEEK_END);
-		rom_size = ftell(file);
-		fseek(file, 0, SEEK_SET);
+	for (u32 i = 0; i < 256; ++i) {
+		cpu.timing.cost[i] = 1;
+	}
 
-		if (rom_size > memory_size + BOOT_VECTOR) {
-			printf("ROM file is too large\n");
-			return 1;
-		}
+	if (timing_file != NULL && !load_timing(&cpu, timing_file)) {
+		return 1;
+	}
 
-		if (fread(&cpu.memory.data[BOOT_VECTOR], 1, rom_size, file) != rom_size) {
-			printf("Failed to read ROM file\n");
+	cpu.timing.clock_hz = turbo ? 0 : clock_hz;
+	cpu.stats.enabled = stats_file != NULL;
+	if (heatmap_file != NULL && !heatmap_init(&cpu, heatmap_granule, heatmap_interval)) {
+		return 1;
+	}
+
+	for (u32 i = 0; i < CACHE_KIND_COUNT; ++i) {
+		if (cache_geometry[i] != NULL && !cache_init(&cpu, (cache_kind_t) i, cache_geometry[i])) {
 			return 1;
 		}
+	}
 
-		fclose(file);
+	if (!cache_model_init(&cpu)) {
+		return 1;
 	}
-    
+
+	cpu.latency.enabled = latency != 0;
+	cpu.latency.overlay = latency == 2;
+	if (trace_file != NULL && !trace_open(&cpu, trace_file)) {
+		return 1;
+	}
+
     SDL_TimerID timer_id;
     if (is_graphical) {
         if (SDL_Init(SDL_INIT_VIDEO) != 0) {
@@ -326,7 +916,7 @@ s32 main(s32 argc, char** argv) {
         }
         
         char* base = "krisc32 emulator (";
-        char* title = malloc(strlen(base) + strlen(rom_file) + 2);
+        title = malloc(strlen(base) + strlen(rom_file) + 2);
         if (title == NULL) {
             printf("Failed to allocate string\n");
             return 1;
@@ -343,13 +933,93 @@ s32 main(s32 argc, char** argv) {
         }
         
         cpu.graphical.surface = SDL_GetWindowSurface(cpu.graphical.window);
-        timer_id = SDL_AddTimer(16, timer_callback, cpu.graphical.window);
+        /* kept for --stats, the name is gone once SDL_Quit has run */
+        if (SDL_GetCurrentVideoDriver() != NULL) {
+            snprintf(cpu.stats.video_driver, sizeof(cpu.stats.video_driver), "%s", SDL_GetCurrentVideoDriver());
+        }
+        timer_id = SDL_AddTimer(16, timer_callback, &cpu);
+    } else if (cpu.timing.clock_hz != 0) {
+        if (SDL_Init(SDL_INIT_TIMER) != 0) {
+            printf("Failed to init SDL\n");
+            return 1;
+        }
     }
 	
-	cpu.regs.protected.ip = BOOT_VECTOR;
+	cpu.regs.protected.ip = cpu.boot_vector;
+	cpu.timing.pace_counter = SDL_GetPerformanceCounter();
+	cpu.timing.pace_cycles = 0;
+
+    live_t live = { 0 };
+    if (live_stats && !live_open(&live, &cpu, rom_file)) {
+        return 1;
+    }
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+    u64 start_counter = SDL_GetPerformanceCounter();
+    u64 iterations = 0;
+    u64 last_overlay = start_counter;
+
+    cpu.track_idle = stats_file != NULL || live_stats;
+    update_instrumented(&cpu);
+
+    /*
+     * everything optional in the loop (instruction limit, heatmap samples, pacing, live stats) runs when
+     * iterations reaches next_event, so a plain run pays for one compare per instruction
+     */
+    u64 next_event = 0;
+    u64 next_live = LIVE_STATS_INTERVAL;
+    u64 next_pace = PACE_INTERVAL;
     
     s32 closed = 0;
-	while (!closed) {
+	while (!closed && !interrupted) {
+        ++iterations;
+        if (iterations >= next_event) {
+            if (max_instructions != 0 && cpu.retired >= max_instructions) {
+                break;
+            }
+
+            if (cpu.heatmap.enabled && cpu.retired >= cpu.heatmap.next_sample) {
+                heatmap_sample(&cpu);
+            }
+
+            if (cpu.timing.clock_hz != 0 && cpu.retired >= next_pace) {
+                pace_execution(&cpu);
+                next_pace = cpu.retired + PACE_INTERVAL;
+            }
+
+            if (iterations >= next_live) {
+                next_live = iterations + LIVE_STATS_INTERVAL;
+                if (live.shared != NULL) {
+                    live_publish(&live, &cpu);
+                }
+
+                if (cpu.latency.overlay && is_graphical) {
+                    u64 now = SDL_GetPerformanceCounter();
+                    if (now - last_overlay >= SDL_GetPerformanceFrequency() / LATENCY_OVERLAY_HZ) {
+                        last_overlay = now;
+                        latency_overlay(&cpu, title);
+                    }
+                }
+            }
+
+            /* at most one instruction retires per iteration, so distances in retired instructions never overshoot */
+            u64 distance = next_live - iterations;
+            if (max_instructions != 0 && max_instructions - cpu.retired < distance) {
+                distance = max_instructions - cpu.retired;
+            }
+
+            if (cpu.heatmap.enabled && cpu.heatmap.next_sample - cpu.retired < distance) {
+                distance = cpu.heatmap.next_sample - cpu.retired;
+            }
+
+            if (cpu.timing.clock_hz != 0 && next_pace - cpu.retired < distance) {
+                distance = next_pace - cpu.retired;
+            }
+
+            next_event = iterations + ((distance != 0) ? distance : 1);
+        }
+
         if (is_graphical) {
             SDL_Event event;
             while (SDL_PollEvent(&event)) {
@@ -367,20 +1037,41 @@ s32 main(s32 argc, char** argv) {
                         
                         cpu.mapped.keystate.scancode = sc;
                         cpu.mapped.keystate.state = event.key.state == SDL_PRESSED;
+                        if (cpu.latency.enabled) {
+                            /* SDL only timestamps events in milliseconds since init, move that onto the performance counter */
+                            u64 now = SDL_GetPerformanceCounter();
+                            u64 age = (u64) (Uint32) (SDL_GetTicks() - event.key.timestamp) * SDL_GetPerformanceFrequency() / 1000;
+                            cpu.latency.pending_arrival = (age < now) ? now - age : 1;
+                        }
+
                         issue_interrupt(&cpu, KEYINTERRUPT);
+                        cpu.latency.pending_arrival = 0;
                         break;
                     }
                 }
             }
         }
         
-        if (!cpu.halt) {
+        if (!cpu.halt && !cpu.instrumented && !print_status && !is_graphical) {
+            /* nothing looks at single instructions, run the whole stretch up to the next event at once */
+            u64 executed = 0;
+            s32 ok = run_uninstrumented(&cpu, next_event - iterations, &executed);
+            iterations += executed - 1;
+            if (!ok) {
+                break;
+            }
+        } else if (!cpu.halt) {
+            u32 ip = cpu.regs.protected.ip;
             u8 opcode = cpu.memory.data[cpu.regs.protected.ip];
             ++cpu.regs.protected.ip;
             
             if (!issue_opcode(&cpu, opcode)) {
                 break;
             }
+
+            if (cpu.track_idle && cpu.regs.protected.ip == ip) {
+                ++cpu.idle_spins;
+            }
             
             if (print_status) {
                 printf("Processor state:\n");
@@ -402,13 +1093,45 @@ s32 main(s32 argc, char** argv) {
                 cpu.interrupts.is_issuing = 0;
                 cpu.interrupts.is_issuing_exception = 0;
             }
+        } else if (!is_graphical) {
+            /* nothing can raise an interrupt without a window, so a halted cpu stays halted */
+            break;
         }
 	}
+
+    f64 wall_seconds = (f64) (SDL_GetPerformanceCounter() - start_counter) / (f64) SDL_GetPerformanceFrequency();
+    if (live.shared != NULL) {
+        live_close(&live);
+    }
+
+    if (cpu.trace.enabled) {
+        trace_close(&cpu);
+    }
     
     if (is_graphical) {
         SDL_RemoveTimer(timer_id);
         SDL_DestroyWindow(cpu.graphical.window);
         SDL_Quit();
+    } else if (cpu.timing.clock_hz != 0) {
+        SDL_Quit();
+    }
+
+    if (stats_file != NULL && !write_stats(&cpu, stats_file, wall_seconds)) {
+        free(cpu.memory.data);
+        return 1;
+    }
+
+    if (heatmap_file != NULL && !heatmap_write(&cpu, heatmap_file)) {
+        free(cpu.memory.data);
+        return 1;
+    }
+
+    if (cpu.cache.enabled) {
+        cache_report(&cpu);
+    }
+
+    if (cpu.latency.enabled) {
+        latency_report(&cpu);
     }
 
 	free(cpu.memory.data);
@@ -416,6 +1139,10 @@ s32 main(s32 argc, char** argv) {
 }
 
 void graphical_putpixel(cpu_t* cpu, u32 x, u32 y, u8 r, u8 g, u8 b) {
+    if (cpu->stats.enabled) {
+        ++cpu->stats.pixels_written;
+    }
+
     u8* pixels = (u8*) cpu->graphical.surface->pixels;
     u16 sx = x * GRAPHICAL_SCALE;
     u16 sy = y * GRAPHICAL_SCALE;
@@ -432,6 +1159,10 @@ void graphical_putpixel(cpu_t* cpu, u32 x, u32 y, u8 r, u8 g, u8 b) {
 }
 
 u8 graphical_getpixel(cpu_t* cpu, u32 x, u32 y) {
+    if (cpu->stats.enabled) {
+        ++cpu->stats.pixels_read;
+    }
+
     u8* pixels = (u8*) cpu->graphical.surface->pixels;
     u16 sx = x * GRAPHICAL_SCALE;
     u16 sy = y * GRAPHICAL_SCALE;
@@ -510,6 +1241,7 @@ s32 handle_ldm8(cpu_t* cpu) {
 	}
     
     if (cpu->graphical.window != NULL && *r_b >= GRAPHICAL_VECTOR && *r_b < GRAPHICAL_VECTOR + GRAPHICAL_SIZE) {
+        record_access(cpu, ACCESS_LOAD, *r_b, 1, ACCESS_REGION_FRAMEBUFFER);
         u8* pixels = (u8*) cpu->graphical.surface->pixels;
         u32 index = *r_b - GRAPHICAL_VECTOR;
         u16 x = index % GRAPHICAL_WIDTH;
@@ -520,6 +1252,7 @@ s32 handle_ldm8(cpu_t* cpu) {
     }
     
     if (*r_b >= KEYINPUT_VECTOR && *r_b < KEYINPUT_VECTOR + KEYINPUT_SIZE) {
+        record_access(cpu, ACCESS_LOAD, *r_b, 1, ACCESS_REGION_KEYINPUT);
         if (*r_b == KEYINPUT_VECTOR) {
             *r_a = cpu->mapped.keystate.scancode;
         } else {
@@ -529,10 +1262,12 @@ s32 handle_ldm8(cpu_t* cpu) {
     }
 
 	if (*r_b >= cpu->memory.size) {
+        record_access(cpu, ACCESS_LOAD, *r_b, 1, ACCESS_REGION_OUT_OF_RANGE);
         *r_a = 0;
         return 1;
 	}
 
+	record_access(cpu, ACCESS_LOAD, *r_b, 1, ACCESS_REGION_RAM);
 	*r_a = cpu->memory.data[*r_b];
 	return 1;
 }
@@ -557,6 +1292,7 @@ s32 handle_ldm16(cpu_t* cpu) {
 	}
     
     if (cpu->graphical.window != NULL && *r_b >= GRAPHICAL_VECTOR && *r_b < GRAPHICAL_VECTOR + GRAPHICAL_SIZE) {
+        record_access(cpu, ACCESS_LOAD, *r_b, 2, ACCESS_REGION_FRAMEBUFFER);
         u8* pixels = (u8*) cpu->graphical.surface->pixels;
         u32 index = *r_b - GRAPHICAL_VECTOR;
         u16 x = index % GRAPHICAL_WIDTH;
@@ -574,15 +1310,18 @@ s32 handle_ldm16(cpu_t* cpu) {
     }
     
     if (*r_b >= KEYINPUT_VECTOR && *r_b < KEYINPUT_VECTOR + KEYINPUT_SIZE) {
+        record_access(cpu, ACCESS_LOAD, *r_b, 2, ACCESS_REGION_KEYINPUT);
         *r_a = cpu->mapped.keystate.scancode | (cpu->mapped.keystate.state << 8);
         return 1;
     }
 
 	if (*r_b >= cpu->memory.size) {
+        record_access(cpu, ACCESS_LOAD, *r_b, 2, ACCESS_REGION_OUT_OF_RANGE);
         *r_a = 0;
         return 1;
 	}
 
+	record_access(cpu, ACCESS_LOAD, *r_b, 2, ACCESS_REGION_RAM);
 	*r_a = FETCH_U16(cpu->memory.data, *r_b);
 	return 1;
 }
@@ -607,6 +1346,7 @@ s32 handle_ldm32(cpu_t* cpu) {
 	}
     
     if (cpu->graphical.window != NULL && *r_b >= GRAPHICAL_VECTOR && *r_b < GRAPHICAL_VECTOR + GRAPHICAL_SIZE) {
+        record_access(cpu, ACCESS_LOAD, *r_b, 4, ACCESS_REGION_FRAMEBUFFER);
         u8* pixels = (u8*) cpu->graphical.surface->pixels;
         u32 index = *r_b - GRAPHICAL_VECTOR;
         u16 x = index % GRAPHICAL_WIDTH;
@@ -636,10 +1376,12 @@ s32 handle_ldm32(cpu_t* cpu) {
     }
 
 	if (*r_b >= cpu->memory.size) {
+        record_access(cpu, ACCESS_LOAD, *r_b, 4, ACCESS_REGION_OUT_OF_RANGE);
         *r_a = 0;
         return 1;
 	}
 
+	record_access(cpu, ACCESS_LOAD, *r_b, 4, ACCESS_REGION_RAM);
 	*r_a = FETCH_U32(cpu->memory.data, *r_b);
 	return 1;
 }
@@ -664,6 +1406,7 @@ s32 handle_str8(cpu_t* cpu) {
 	}
     
     if (cpu->graphical.window != NULL && *r_a >= GRAPHICAL_VECTOR && *r_a < GRAPHICAL_VECTOR + GRAPHICAL_SIZE) {
+        record_access(cpu, ACCESS_STORE, *r_a, 1, ACCESS_REGION_FRAMEBUFFER);
         u8* pixels = (u8*) cpu->graphical.surface->pixels;
         u8 r = (*r_b & 0xE0) >> 5;
         u8 g = (*r_b & 0x1C) >> 2;
@@ -677,9 +1420,11 @@ s32 handle_str8(cpu_t* cpu) {
     }
 
 	if (*r_a >= cpu->memory.size) {
+        record_access(cpu, ACCESS_STORE, *r_a, 1, ACCESS_REGION_OUT_OF_RANGE);
         return 1;
 	}
 
+	record_access(cpu, ACCESS_STORE, *r_a, 1, ACCESS_REGION_RAM);
 	cpu->memory.data[*r_a] = *r_b;
 	return 1;
 }
@@ -704,6 +1449,7 @@ s32 handle_str16(cpu_t* cpu) {
 	}
     
     if (cpu->graphical.window != NULL && *r_a >= GRAPHICAL_VECTOR && *r_a + 1 < GRAPHICAL_VECTOR + GRAPHICAL_SIZE) {
+        record_access(cpu, ACCESS_STORE, *r_a, 2, ACCESS_REGION_FRAMEBUFFER);
         u8* pixels = (u8*) cpu->graphical.surface->pixels;
         u8 r = (*r_b & 0xE0) >> 5;
         u8 g = (*r_b & 0x1C) >> 2;
@@ -728,9 +1474,11 @@ s32 handle_str16(cpu_t* cpu) {
     }
 
 	if (*r_a >= cpu->memory.size) {
+        record_access(cpu, ACCESS_STORE, *r_a, 2, ACCESS_REGION_OUT_OF_RANGE);
         return 1;
 	}
 
+	record_access(cpu, ACCESS_STORE, *r_a, 2, ACCESS_REGION_RAM);
 	FETCH_U16(cpu->memory.data, *r_a) = *r_b;
 	return 1;
 }
@@ -755,6 +1503,7 @@ s32 handle_str32(cpu_t* cpu) {
 	}
     
     if (cpu->graphical.window != NULL && *r_a >= GRAPHICAL_VECTOR && *r_a + 3 < GRAPHICAL_VECTOR + GRAPHICAL_SIZE) {
+        record_access(cpu, ACCESS_STORE, *r_a, 4, ACCESS_REGION_FRAMEBUFFER);
         u8* pixels = (u8*) cpu->graphical.surface->pixels;
         
         u8 r = (*r_b & 0xE0) >> 5;
@@ -800,9 +1549,11 @@ s32 handle_str32(cpu_t* cpu) {
     }
 
 	if (*r_a >= cpu->memory.size) {
+        record_access(cpu, ACCESS_STORE, *r_a, 4, ACCESS_REGION_OUT_OF_RANGE);
         return 1;
 	}
 
+	record_access(cpu, ACCESS_STORE, *r_a, 4, ACCESS_REGION_RAM);
 	FETCH_U32(cpu->memory.data, *r_a) = *r_b;
 	return 1;
 }
@@ -1151,6 +1902,7 @@ s32 handle_jnz(cpu_t* cpu) {
 		}
 
 		cpu->regs.protected.ip = *r_b;
+		PMU_COUNT(cpu, PMU_EVENT_BRANCH_TAKEN);
 	}
 	return 1;
 }
@@ -1178,6 +1930,7 @@ s32 handle_jz(cpu_t* cpu) {
 		}
 
 		cpu->regs.protected.ip = *r_b;
+		PMU_COUNT(cpu, PMU_EVENT_BRANCH_TAKEN);
 	}
 	return 1;
 }
@@ -1196,6 +1949,7 @@ s32 handle_jmp(cpu_t* cpu) {
 	}
 
 	cpu->regs.protected.ip = *r;
+	PMU_COUNT(cpu, PMU_EVENT_BRANCH_TAKEN);
 	return 1;
 }
 
@@ -1217,6 +1971,7 @@ s32 handle_jnzi(cpu_t* cpu) {
 		}
 
 		cpu->regs.protected.ip = addr;
+		PMU_COUNT(cpu, PMU_EVENT_BRANCH_TAKEN);
 	}
 	return 1;
 }
@@ -1239,6 +1994,7 @@ s32 handle_jzi(cpu_t* cpu) {
 		}
 
 		cpu->regs.protected.ip = addr;
+		PMU_COUNT(cpu, PMU_EVENT_BRANCH_TAKEN);
 	}
 	return 1;
 }
@@ -1251,6 +2007,7 @@ s32 handle_jmpi(cpu_t* cpu) {
 	}
 
 	cpu->regs.protected.ip = addr;
+	PMU_COUNT(cpu, PMU_EVENT_BRANCH_TAKEN);
 	return 1;
 }
 
@@ -1272,6 +2029,10 @@ s32 handle_link(cpu_t* cpu) {
 	}
 
 	cpu->regs.protected.ip = *r;
+	PMU_COUNT(cpu, PMU_EVENT_BRANCH_TAKEN);
+	if (cpu->cache.enabled) {
+		cache_enter(cpu, *r);
+	}
 	return 1;
 }
 
@@ -1286,6 +2047,14 @@ s32 handle_ret(cpu_t* cpu) {
 	}
 
 	cpu->regs.protected.ip = address;
+	PMU_COUNT(cpu, PMU_EVENT_BRANCH_TAKEN);
+	if (cpu->cache.enabled) {
+		cache_leave(cpu);
+	}
+
+	if (cpu->latency.enabled) {
+		latency_leave(cpu);
+	}
 	return 1;
 }
 
@@ -1328,12 +2097,106 @@ s32 handle_halt(cpu_t* cpu) {
 	return 1;
 }
 
+void update_instrumented(cpu_t* cpu) {
+	u8 pmu_armed = 0;
+	for (u32 i = 0; i < PMU_EVENT_COUNT; ++i) {
+		pmu_armed |= cpu->pmu.event_mask[i];
+	}
+
+	cpu->instrumented = cpu->stats.enabled || cpu->cache.enabled || cpu->track_idle || pmu_armed != 0;
+}
+
+void pmu_configure(cpu_t* cpu, u32 index, u8 event, s32 interrupt_on_overflow) {
+	pmu_counter_t* counter = &cpu->pmu.counters[index];
+	cpu->pmu.event_mask[counter->event] &= ~(1 << index);
+	counter->event = event;
+	counter->interrupt_on_overflow = (u8) interrupt_on_overflow;
+	cpu->pmu.pending &= ~(1 << index);
+
+	if (event != PMU_EVENT_NONE) {
+		cpu->pmu.event_mask[event] |= 1 << index;
+	}
+	update_instrumented(cpu);
+}
+
+void pmu_count(cpu_t* cpu, pmu_event_t event) {
+	u8 mask = cpu->pmu.event_mask[event];
+	for (u32 i = 0; i < PMU_COUNTER_COUNT; ++i) {
+		if ((mask & (1 << i)) == 0) {
+			continue;
+		}
+
+		pmu_counter_t* counter = &cpu->pmu.counters[i];
+		++counter->value;
+		if (counter->value == 0) {
+			cpu->pmu.overflow |= 1 << i;
+			if (counter->interrupt_on_overflow) {
+				cpu->pmu.pending |= 1 << i;
+			}
+		}
+	}
+}
+
+void record_access(cpu_t* cpu, access_kind_t kind, u32 address, u8 size, access_region_t region) {
+	PMU_COUNT(cpu, kind == ACCESS_LOAD ? PMU_EVENT_LOAD : PMU_EVENT_STORE);
+	if (region == ACCESS_REGION_FRAMEBUFFER || region == ACCESS_REGION_KEYINPUT) {
+		PMU_COUNT(cpu, PMU_EVENT_MMIO);
+	}
+
+	if (cpu->stats.enabled) {
+		++cpu->stats.accesses[kind][size >> 1][region];
+	}
+
+	if (cpu->heatmap.enabled && region == ACCESS_REGION_RAM && address < cpu->memory.size) {
+		heatmap_t* heatmap = &cpu->heatmap;
+		u32 granule = address >> heatmap->granule_shift;
+		if (kind == ACCESS_LOAD) {
+			++heatmap->loads[granule];
+		} else {
+			++heatmap->stores[granule];
+		}
+
+		if (!heatmap->touched[granule]) {
+			heatmap->touched[granule] = 1;
+			++heatmap->touched_count;
+		}
+	}
+
+	if (cpu->cache.enabled && region == ACCESS_REGION_RAM) {
+		cache_access(cpu, CACHE_DATA, address, size);
+	}
+}
+
+/* never blocks, a full ring drops the record and the next one that fits carries the count */
+void trace_emit(cpu_t* cpu) {
+	trace_t* trace = &cpu->trace;
+	u32 head = (u32) SDL_AtomicGet(&trace->head);
+	u32 tail = (u32) SDL_AtomicGet(&trace->tail);
+	if (head - tail >= TRACE_RING_SIZE) {
+		if (trace->dropped_pending != 0xFFFFFFFF) {
+			++trace->dropped_pending;
+		}
+		++trace->dropped;
+		return;
+	}
+
+	trace_record_t* record = &trace->ring[head & (TRACE_RING_SIZE - 1)];
+	record->retired = cpu->retired;
+	record->id = cpu->regs.sys[0];
+	memcpy(record->payload, &cpu->regs.sys[1], sizeof(record->payload));
+	record->dropped_before = trace->dropped_pending;
+	trace->dropped_pending = 0;
+
+	SDL_MemoryBarrierRelease();
+	SDL_AtomicSet(&trace->head, (int) (head + 1));
+}
+
 s32 handle_sys(cpu_t* cpu) {
 	u8 id = cpu->memory.data[cpu->regs.protected.ip];
 	++cpu->regs.protected.ip;
 	switch (id) {
 	case 0x00:
-		cpu->regs.sys[0] = BOOT_VECTOR;
+		cpu->regs.sys[0] = cpu->boot_vector;
 		break;
 	case 0x01:
 		cpu->regs.sys[0] = cpu->memory.size;
@@ -1352,6 +2215,44 @@ s32 handle_sys(cpu_t* cpu) {
 			return 0;
 		}
 		break;
+	case 0x05:
+		cpu->regs.sys[0] = (u32) cpu->cycles;
+		cpu->regs.sys[1] = (u32) (cpu->cycles >> 32);
+		break;
+	case 0x06:
+		cpu->regs.sys[0] = (u32) cpu->retired;
+		cpu->regs.sys[1] = (u32) (cpu->retired >> 32);
+		break;
+	case 0x07:
+		if (cpu->regs.sys[0] >= PMU_COUNTER_COUNT || cpu->regs.sys[1] >= PMU_EVENT_COUNT) {
+			issue_exception(cpu, EXCEPTION_INVALID_INSTRUCTION);
+			return 0;
+		}
+		pmu_configure(cpu, cpu->regs.sys[0], (u8) cpu->regs.sys[1], cpu->regs.sys[2] & 0x01);
+		break;
+	case 0x08:
+		if (cpu->regs.sys[0] >= PMU_COUNTER_COUNT) {
+			issue_exception(cpu, EXCEPTION_INVALID_INSTRUCTION);
+			return 0;
+		}
+		cpu->regs.sys[0] = cpu->pmu.counters[cpu->regs.sys[0]].value;
+		break;
+	case 0x09:
+		if (cpu->regs.sys[0] >= PMU_COUNTER_COUNT) {
+			issue_exception(cpu, EXCEPTION_INVALID_INSTRUCTION);
+			return 0;
+		}
+		cpu->pmu.counters[cpu->regs.sys[0]].value = cpu->regs.sys[1];
+		break;
+	case 0x0A:
+		cpu->regs.sys[0] = cpu->pmu.overflow;
+		cpu->pmu.overflow = 0;
+		break;
+	case 0x0B:
+		if (cpu->trace.enabled) {
+			trace_emit(cpu);
+		}
+		break;
 	default:
 		issue_exception(cpu, EXCEPTION_INVALID_INSTRUCTION);
 		return 0;
@@ -1370,6 +2271,8 @@ typedef struct instruction {
 	s32(*handler)(cpu_t* cpu);
 	char* (*as_string)(struct instruction* inst, cpu_t* cpu);
 	char* name;
+	/* encoded length in bytes, including the opcode */
+	u8 size;
 } instruction_t;
 
 char register_string_buffer[20];
@@ -1640,48 +2543,80 @@ char* int_string(instruction_t* inst, cpu_t* cpu) {
 }
 
 instruction_t instructions[256] = {
-	[0x01] = { .handler = handle_ldi, .as_string = ldi_string, .name = "ldi"},
-	[0x02] = {.handler = handle_ldr, .as_string = ldr_string, .name = "ldr" },
-	[0x03] = {.handler = handle_ldm8, .as_string = ldm8_string, .name = "ldm8" },
-	[0x04] = {.handler = handle_ldm16, .as_string = ldm16_string, .name = "ldm16" },
-	[0x05] = {.handler = handle_ldm32, .as_string = ldm32_string, .name = "ldm32" },
-
-	[0x06] = {.handler = handle_str8, .as_string = str8_string, .name = "str8" },
-	[0x07] = {.handler = handle_str16, .as_string = str16_string, .name = "str16" },
-	[0x08] = {.handler = handle_str32, .as_string = str32_string, .name = "str32" },
-
-	[0x09] = {.handler = handle_add, .as_string = add_string, .name = "add" },
-	[0x0A] = {.handler = handle_sub, .as_string = sub_string, .name = "sub" },
-	[0x0B] = {.handler = handle_mul, .as_string = mul_string, .name = "mul" },
-	[0x0C] = {.handler = handle_div, .as_string = div_string, .name = "div" },
-	[0x0D] = {.handler = handle_rem, .as_string = rem_string, .name = "rem" },
-
-	[0x0E] = {.handler = handle_shr, .as_string = shr_string, .name = "shr" },
-	[0x0F] = {.handler = handle_shl, .as_string = shl_string, .name = "shl" },
-	[0x10] = {.handler = handle_and, .as_string = and_string,  .name = "and" },
-	[0x11] = {.handler = handle_or, .as_string = or_string,  .name = "or" },
-	[0x12] = {.handler = handle_not, .as_string = not_string,  .name = "not" },
-	[0x13] = {.handler = handle_xor, .as_string = xor_string,  .name = "xor" },
-
-	[0x14] = {.handler = handle_jnz, .as_string = jnz_string, .name = "jnz" },
-	[0x15] = {.handler = handle_jz, .as_string = jz_string, .name = "jz" },
-	[0x16] = {.handler = handle_jmp, .as_string = jmp_string, .name = "jmp" },
-	[0x17] = {.handler = handle_link, .as_string = link_string, .name = "link" },
-	[0x18] = {.handler = handle_ret, .as_string = ret_string, .name = "ret" },
-
-	[0x19] = {.handler = handle_push, .as_string = push_string, .name = "push" },
-	[0x1A] = {.handler = handle_pop, .as_string = pop_string, .name = "pop" },
-
-	[0x40] = {.handler = handle_jnzi, .as_string = jnzi_string, .name = "jnzi" },
-	[0x41] = {.handler = handle_jzi, .as_string = jzi_string, .name = "jzi" },
-	[0x42] = {.handler = handle_jmpi, .as_string = jmpi_string, .name = "jmpi" },
-
-	[0x60] = {.handler = handle_halt, .as_string = halt_string, .name = "halt" },
-	[0x80] = {.handler = handle_sys, .as_string = sys_string, .name = "sys" },
-	[0xF0] = {.handler = handle_int, .as_string = int_string, .name = "int" },
+	[0x01] = { .handler = handle_ldi, .as_string = ldi_string, .name = "ldi", .size = 6 },
+	[0x02] = {.handler = handle_ldr, .as_string = ldr_string, .name = "ldr", .size = 3 },
+	[0x03] = {.handler = handle_ldm8, .as_string = ldm8_string, .name = "ldm8", .size = 3 },
+	[0x04] = {.handler = handle_ldm16, .as_string = ldm16_string, .name = "ldm16", .size = 3 },
+	[0x05] = {.handler = handle_ldm32, .as_string = ldm32_string, .name = "ldm32", .size = 3 },
+
+	[0x06] = {.handler = handle_str8, .as_string = str8_string, .name = "str8", .size = 3 },
+	[0x07] = {.handler = handle_str16, .as_string = str16_string, .name = "str16", .size = 3 },
+	[0x08] = {.handler = handle_str32, .as_string = str32_string, .name = "str32", .size = 3 },
+
+	[0x09] = {.handler = handle_add, .as_string = add_string, .name = "add", .size = 4 },
+	[0x0A] = {.handler = handle_sub, .as_string = sub_string, .name = "sub", .size = 4 },
+	[0x0B] = {.handler = handle_mul, .as_string = mul_string, .name = "mul", .size = 4 },
+	[0x0C] = {.handler = handle_div, .as_string = div_string, .name = "div", .size = 4 },
+	[0x0D] = {.handler = handle_rem, .as_string = rem_string, .name = "rem", .size = 4 },
+
+	[0x0E] = {.handler = handle_shr, .as_string = shr_string, .name = "shr", .size = 4 },
+	[0x0F] = {.handler = handle_shl, .as_string = shl_string, .name = "shl", .size = 4 },
+	[0x10] = {.handler = handle_and, .as_string = and_string,  .name = "and", .size = 4 },
+	[0x11] = {.handler = handle_or, .as_string = or_string,  .name = "or", .size = 4 },
+	[0x12] = {.handler = handle_not, .as_string = not_string,  .name = "not", .size = 3 },
+	[0x13] = {.handler = handle_xor, .as_string = xor_string,  .name = "xor", .size = 4 },
+
+	[0x14] = {.handler = handle_jnz, .as_string = jnz_string, .name = "jnz", .size = 3 },
+	[0x15] = {.handler = handle_jz, .as_string = jz_string, .name = "jz", .size = 3 },
+	[0x16] = {.handler = handle_jmp, .as_string = jmp_string, .name = "jmp", .size = 2 },
+	[0x17] = {.handler = handle_link, .as_string = link_string, .name = "link", .size = 2 },
+	[0x18] = {.handler = handle_ret, .as_string = ret_string, .name = "ret", .size = 1 },
+
+	[0x19] = {.handler = handle_push, .as_string = push_string, .name = "push", .size = 2 },
+	[0x1A] = {.handler = handle_pop, .as_string = pop_string, .name = "pop", .size = 2 },
+
+	[0x40] = {.handler = handle_jnzi, .as_string = jnzi_string, .name = "jnzi", .size = 6 },
+	[0x41] = {.handler = handle_jzi, .as_string = jzi_string, .name = "jzi", .size = 6 },
+	[0x42] = {.handler = handle_jmpi, .as_string = jmpi_string, .name = "jmpi", .size = 5 },
+
+	[0x60] = {.handler = handle_halt, .as_string = halt_string, .name = "halt", .size = 1 },
+	[0x80] = {.handler = handle_sys, .as_string = sys_string, .name = "sys", .size = 2 },
+	[0xF0] = {.handler = handle_int, .as_string = int_string, .name = "int", .size = 2 },
 };
 
+void latency_enter(cpu_t* cpu) {
+	latency_t* latency = &cpu->latency;
+	u64 now = SDL_GetPerformanceCounter();
+	if (latency->pending_arrival != 0) {
+		histogram_add(&latency->input, counter_to_ns(now - latency->pending_arrival));
+		latency->pending_arrival = 0;
+	}
+
+	if (latency->handler_depth < LATENCY_HANDLER_DEPTH) {
+		latency->handlers[latency->handler_depth].entered = now;
+		latency->handlers[latency->handler_depth].sp = cpu->regs.gp.sp;
+		++latency->handler_depth;
+	}
+}
+
+void latency_leave(cpu_t* cpu) {
+	latency_t* latency = &cpu->latency;
+	/* handlers whose frame was unwound without a matching ret are dropped */
+	while (latency->handler_depth > 0 && cpu->regs.gp.sp > latency->handlers[latency->handler_depth - 1].sp + 4) {
+		--latency->handler_depth;
+	}
+
+	if (latency->handler_depth > 0 && cpu->regs.gp.sp == latency->handlers[latency->handler_depth - 1].sp + 4) {
+		--latency->handler_depth;
+		histogram_add(&latency->handler, counter_to_ns(SDL_GetPerformanceCounter() - latency->handlers[latency->handler_depth].entered));
+	}
+}
+
 s32 issue_exception(cpu_t* cpu, u8 type) {
+	if (cpu->stats.enabled) {
+		++cpu->stats.exceptions[type];
+	}
+
 	if (cpu->interrupts.is_issuing_exception) {
 		cpu->halt = 1;
 		printf("Nested exception: 0x%02x\n", type);
@@ -1702,6 +2637,14 @@ s32 issue_exception(cpu_t* cpu, u8 type) {
 	cpu->regs.sys[1] = cpu->regs.protected.ip;
 	cpu->regs.protected.ip = address;
 	cpu->interrupts.is_issuing_exception = 1;
+	++cpu->interrupts_taken;
+	if (cpu->latency.enabled) {
+		latency_enter(cpu);
+	}
+	PMU_COUNT(cpu, PMU_EVENT_INTERRUPT);
+	if (cpu->cache.enabled) {
+		cache_enter(cpu, address);
+	}
 	return 1;
 }
 
@@ -1712,24 +2655,265 @@ s32 issue_interrupt(cpu_t* cpu, u8 interrupt) {
 
 	u32 address = cpu->interrupts.handler_address;
 	if (address >= cpu->memory.size) {
+		if (cpu->stats.enabled) {
+			++cpu->stats.interrupts_ignored;
+		}
 		return 1;
 	}
 
+	if (cpu->stats.enabled) {
+		++cpu->stats.interrupts[interrupt];
+	}
+
 	cpu->regs.sys[7] = interrupt;
 	push_stack(cpu, cpu->regs.protected.ip);
 	cpu->regs.protected.ip = address;
 	cpu->interrupts.is_issuing = 1;
+	++cpu->interrupts_taken;
+	if (cpu->latency.enabled) {
+		latency_enter(cpu);
+	}
+	PMU_COUNT(cpu, PMU_EVENT_INTERRUPT);
+	if (cpu->cache.enabled) {
+		cache_enter(cpu, address);
+	}
 	return 1;
 }
 
 s32 issue_opcode(cpu_t* cpu, u8 opcode) {
 	instruction_t* inst = &instructions[opcode];
 	if (inst->handler == NULL) {
+		/* counted before faulting so the stats can report it as "invalid" */
+		if (cpu->stats.enabled) {
+			++cpu->stats.opcodes[opcode];
+		}
+
 		issue_exception(cpu, EXCEPTION_INVALID_INSTRUCTION);
 		return 0;
 	}
 
-	return inst->handler(cpu);
+	cpu->cycles += cpu->timing.cost[opcode];
+	if (!cpu->instrumented) {
+		if (!inst->handler(cpu)) {
+			return 0;
+		}
+
+		++cpu->retired;
+		return 1;
+	}
+
+	if (cpu->stats.enabled) {
+		++cpu->stats.opcodes[opcode];
+	}
+
+	/* the opcode byte has already been consumed */
+	if (cpu->cache.enabled) {
+		cache_access(cpu, CACHE_INSTRUCTION, cpu->regs.protected.ip - 1, inst->size);
+	}
+
+	if (!inst->handler(cpu)) {
+		return 0;
+	}
+
+	++cpu->retired;
+	PMU_COUNT(cpu, PMU_EVENT_RETIRED);
+
+	/*
+	 * overflows are delivered between instructions so a handler never sees a half-executed one. without a valid
+	 * handler issue_interrupt would drop it, so it stays pending until the guest installs one
+	 */
+	if (cpu->pmu.pending != 0 && cpu->interrupts.handler_address < cpu->memory.size) {
+		cpu->pmu.pending = 0;
+		issue_interrupt(cpu, PMUINTERRUPT);
+	}
+	return 1;
+}
+
+/*
+ * the plain run: no hook is on, so fetch and dispatch straight through until count instructions were
+ * issued, the cpu halts, an instruction turns a hook on or one faults, which returns 0 like issue_opcode
+ */
+s32 run_uninstrumented(cpu_t* cpu, u64 count, u64* executed) {
+	u64 issued = 0;
+	while (issued < count && !cpu->halt) {
+		u8 opcode = cpu->memory.data[cpu->regs.protected.ip];
+		++cpu->regs.protected.ip;
+		++issued;
+
+		instruction_t* inst = &instructions[opcode];
+		if (inst->handler == NULL) {
+			issue_exception(cpu, EXCEPTION_INVALID_INSTRUCTION);
+			*executed = issued;
+			return 0;
+		}
+
+		cpu->cycles += cpu->timing.cost[opcode];
+		if (!inst->handler(cpu)) {
+			*executed = issued;
+			return 0;
+		}
+
+		++cpu->retired;
+
+		/* a sys 0x07 can arm the pmu mid batch, the next instruction has to be counted */
+		if (cpu->instrumented) {
+			break;
+		}
+	}
+
+	*executed = issued;
+	return 1;
+}
+
+/*
+ * a flat ROM is copied to the boot vector and runs from there. a k32-ld --sparse image carries its own
+ * addresses, so only its segments are read and execution starts at its entry
+ */
+s32 load_rom(cpu_t* cpu, char* path, s32 load_set) {
+	FILE* file = fopen(path, "rb");
+	if (file == NULL) {
+		printf("Failed to open file: %s\n", path);
+		return 0;
+	}
+
+	usize rom_size = 0;
+	fseek(file, 0, SEEK_END);
+	rom_size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	sparse_header_t header = { 0 };
+	if (rom_size < sizeof(sparse_header_t) || fread(&header, sizeof(sparse_header_t), 1, file) != 1 || memcmp(header.magic, SPARSE_MAGIC, 4) != 0) {
+		fseek(file, 0, SEEK_SET);
+		if ((u64) cpu->boot_vector + rom_size > cpu->memory.size) {
+			printf("ROM file is too large to load at 0x%08x\n", cpu->boot_vector);
+			fclose(file);
+			return 0;
+		}
+
+		if (fread(&cpu->memory.data[cpu->boot_vector], 1, rom_size, file) != rom_size) {
+			printf("Failed to read ROM file\n");
+			fclose(file);
+			return 0;
+		}
+
+		fclose(file);
+		return 1;
+	}
+
+	if (header.version != SPARSE_VERSION) {
+		printf("Unsupported sparse image version %u\n", header.version);
+		fclose(file);
+		return 0;
+	}
+
+	if (load_set) {
+		printf("Warning: ignoring --load, %s is a sparse image with its own addresses\n", path);
+	}
+
+	sparse_segment_t* segments = (sparse_segment_t*) malloc(sizeof(sparse_segment_t) * (header.segment_count + 1));
+	if (segments == NULL || fread(segments, sizeof(sparse_segment_t), header.segment_count, file) != header.segment_count) {
+		printf("Failed to read the sparse image segment table\n");
+		free(segments);
+		fclose(file);
+		return 0;
+	}
+
+	for (u32 i = 0; i < header.segment_count; ++i) {
+		sparse_segment_t* segment = &segments[i];
+		if ((u64) segment->offset + segment->file_size > rom_size || segment->file_size > segment->memory_size) {
+			printf("Sparse image segment %u is out of bounds of the file\n", i);
+			free(segments);
+			fclose(file);
+			return 0;
+		}
+
+		if ((u64) segment->address + segment->memory_size > cpu->memory.size) {
+			printf("Sparse image segment %u at 0x%08x-0x%08llx does not fit in %u bytes of memory\n", i, segment->address, (unsigned long long) segment->address + segment->memory_size, cpu->memory.size);
+			free(segments);
+			fclose(file);
+			return 0;
+		}
+
+		fseek(file, segment->offset, SEEK_SET);
+		if (segment->file_size != 0 && fread(&cpu->memory.data[segment->address], 1, segment->file_size, file) != segment->file_size) {
+			printf("Failed to read sparse image segment %u\n", i);
+			free(segments);
+			fclose(file);
+			return 0;
+		}
+	}
+
+	free(segments);
+	fclose(file);
+
+	if (header.entry >= cpu->memory.size) {
+		printf("Sparse image entry 0x%08x is outside of memory\n", header.entry);
+		return 0;
+	}
+
+	cpu->boot_vector = header.entry;
+	return 1;
+}
+
+/* cost table lines are '<mnemonic or 0xNN> <cycles>', '#' starts a comment */
+s32 load_timing(cpu_t* cpu, char* path) {
+	FILE* file = fopen(path, "r");
+	if (file == NULL) {
+		printf("Failed to open timing file: %s\n", path);
+		return 0;
+	}
+
+	char line[256];
+	u32 line_number = 0;
+	while (fgets(line, sizeof(line), file) != NULL) {
+		++line_number;
+		char* comment = strchr(line, '#');
+		if (comment != NULL) {
+			*comment = '\0';
+		}
+
+		char name[64];
+		u32 cost = 0;
+		s32 matched = sscanf(line, "%63s %u", name, &cost);
+		if (matched <= 0) {
+			continue;
+		}
+
+		if (matched != 2) {
+			printf("%s:%u: expected '<mnemonic or opcode> <cycles>'\n", path, line_number);
+			fclose(file);
+			return 0;
+		}
+
+		s32 opcode = -1;
+		if (name[0] == '0' && name[1] == 'x') {
+			/* anything but hex digits after the 0x leaves opcode at -1 instead of silently reading as 0 */
+			char* end = NULL;
+			unsigned long value = strtoul(&name[2], &end, 16);
+			usize digits = strspn(&name[2], "0123456789abcdefABCDEF");
+			if (digits != 0 && end == &name[2 + digits] && *end == '\0' && value <= 0xFF) {
+				opcode = (s32) value;
+			}
+		} else {
+			for (u32 i = 0; i < 256; ++i) {
+				if (instructions[i].name != NULL && strcmp(instructions[i].name, name) == 0) {
+					opcode = (s32) i;
+					break;
+				}
+			}
+		}
+
+		if (opcode < 0 || opcode > 0xFF || instructions[opcode].handler == NULL) {
+			printf("%s:%u: unknown instruction '%s'\n", path, line_number, name);
+			fclose(file);
+			return 0;
+		}
+
+		cpu->timing.cost[opcode] = cost;
+	}
+
+	fclose(file);
+	return 1;
 }
 
 s32 push_stack(cpu_t* cpu, u32 value) {
@@ -1738,7 +2922,18 @@ s32 push_stack(cpu_t* cpu, u32 value) {
 		return 0;
 	}
 
+	if (cpu->heatmap.enabled) {
+		if (cpu->regs.gp.sp > cpu->heatmap.stack_highest) {
+			cpu->heatmap.stack_highest = cpu->regs.gp.sp;
+		}
+
+		if (cpu->regs.gp.sp - 4 < cpu->heatmap.stack_lowest) {
+			cpu->heatmap.stack_lowest = cpu->regs.gp.sp - 4;
+		}
+	}
+
 	cpu->regs.gp.sp -= 4;
+	record_access(cpu, ACCESS_STORE, cpu->regs.gp.sp, 4, ACCESS_REGION_RAM);
 	FETCH_U32(cpu->memory.data, cpu->regs.gp.sp) = value;
 	return 1;
 }
@@ -1749,6 +2944,7 @@ s32 pop_stack(cpu_t* cpu, u32* value) {
 		return 0;
 	}
 
+	record_access(cpu, ACCESS_LOAD, cpu->regs.gp.sp, 4, ACCESS_REGION_RAM);
 	*value = FETCH_U32(cpu->memory.data, cpu->regs.gp.sp);
 	cpu->regs.gp.sp += 4;
 	return 1;
@@ -1782,3 +2978,775 @@ void print_next_instruction(cpu_t* cpu) {
 	}
 	--cpu->regs.protected.ip;
 }
+
+char* exception_names[256] = {
+	[EXCEPTION_DIVIDE_BY_ZERO] = "divide_by_zero",
+	[EXCEPTION_INVALID_INSTRUCTION] = "invalid_instruction",
+	[0x02] = "invalid_memory",
+	[EXCEPTION_UNPRIVILEDGED_INVOCATION] = "unpriviledged_invocation",
+	[EXCEPTION_UNPRIVILEDGED_MEMORY] = "unpriviledged_memory",
+	[EXCEPTION_STACK_OVERFLOW] = "stack_overflow",
+	[EXCEPTION_STACK_UNDERFLOW] = "stack_underflow",
+};
+
+void write_access_counts(FILE* file, u64 counts[3][ACCESS_REGION_COUNT]) {
+	u32 widths[3] = { 8, 16, 32 };
+	fprintf(file, "{");
+	for (u32 w = 0; w < 3; ++w) {
+		fprintf(file, "%s\"%u\": { \"ram\": %llu, \"framebuffer\": %llu, \"keyinput\": %llu, \"out_of_range\": %llu }", (w == 0) ? " " : ", ", widths[w],
+			(unsigned long long) counts[w][ACCESS_REGION_RAM], (unsigned long long) counts[w][ACCESS_REGION_FRAMEBUFFER],
+			(unsigned long long) counts[w][ACCESS_REGION_KEYINPUT], (unsigned long long) counts[w][ACCESS_REGION_OUT_OF_RANGE]);
+	}
+	fprintf(file, " }");
+}
+
+void write_histogram(FILE* file, char* name, histogram_t* histogram, s32 last) {
+	fprintf(file, "    \"%s\": { \"count\": %llu, \"p50\": %llu, \"p99\": %llu, \"max\": %llu }%s\n", name, (unsigned long long) histogram->count,
+		(unsigned long long) histogram_percentile(histogram, 0.5), (unsigned long long) histogram_percentile(histogram, 0.99),
+		(unsigned long long) histogram->max, last ? "" : ",");
+}
+
+s32 write_stats(cpu_t* cpu, char* path, f64 wall_seconds) {
+	FILE* file = fopen(path, "w");
+	if (file == NULL) {
+		printf("Failed to open stats file: %s\n", path);
+		return 0;
+	}
+
+	fprintf(file, "{\n");
+	fprintf(file, "  \"retired\": %llu,\n", (unsigned long long) cpu->retired);
+	fprintf(file, "  \"cycles\": %llu,\n", (unsigned long long) cpu->cycles);
+
+	u64 invalid = 0;
+	s32 first = 1;
+	fprintf(file, "  \"opcodes\": {");
+	for (u32 i = 0; i < 256; ++i) {
+		if (instructions[i].name == NULL) {
+			invalid += cpu->stats.opcodes[i];
+			continue;
+		}
+
+		fprintf(file, "%s\"%s\": %llu", first ? " " : ", ", instructions[i].name, (unsigned long long) cpu->stats.opcodes[i]);
+		first = 0;
+	}
+	fprintf(file, ", \"invalid\": %llu },\n", (unsigned long long) invalid);
+
+	fprintf(file, "  \"loads\": ");
+	write_access_counts(file, cpu->stats.accesses[ACCESS_LOAD]);
+	fprintf(file, ",\n  \"stores\": ");
+	write_access_counts(file, cpu->stats.accesses[ACCESS_STORE]);
+
+	first = 1;
+	fprintf(file, ",\n  \"interrupts\": {");
+	for (u32 i = 0; i < 256; ++i) {
+		if (cpu->stats.interrupts[i] != 0) {
+			fprintf(file, "%s\"0x%02x\": %llu", first ? " " : ", ", i, (unsigned long long) cpu->stats.interrupts[i]);
+			first = 0;
+		}
+	}
+	fprintf(file, "%s},\n", first ? "" : " ");
+	fprintf(file, "  \"interrupts_ignored\": %llu,\n", (unsigned long long) cpu->stats.interrupts_ignored);
+
+	first = 1;
+	fprintf(file, "  \"exceptions\": {");
+	for (u32 i = 0; i < 256; ++i) {
+		if (cpu->stats.exceptions[i] == 0) {
+			continue;
+		}
+
+		if (exception_names[i] != NULL) {
+			fprintf(file, "%s\"%s\": %llu", first ? " " : ", ", exception_names[i], (unsigned long long) cpu->stats.exceptions[i]);
+		} else {
+			fprintf(file, "%s\"0x%02x\": %llu", first ? " " : ", ", i, (unsigned long long) cpu->stats.exceptions[i]);
+		}
+		first = 0;
+	}
+	fprintf(file, "%s},\n", first ? "" : " ");
+
+	fprintf(file, "  \"frames_presented\": %d,\n", SDL_AtomicGet(&cpu->stats.frames));
+	fprintf(file, "  \"pixels_written\": %llu,\n", (unsigned long long) cpu->stats.pixels_written);
+	fprintf(file, "  \"pixels_read\": %llu,\n", (unsigned long long) cpu->stats.pixels_read);
+	if (cpu->stats.video_driver[0] != '\0') {
+		fprintf(file, "  \"video_driver\": \"%s\",\n", cpu->stats.video_driver);
+	}
+
+	if (cpu->latency.enabled) {
+		fprintf(file, "  \"latency\": {\n");
+		write_histogram(file, "input_ns", &cpu->latency.input, 0);
+		write_histogram(file, "handler_ns", &cpu->latency.handler, 0);
+		write_histogram(file, "present_ns", &cpu->latency.present, 0);
+		write_histogram(file, "frame_interval_ns", &cpu->latency.frame_interval, 1);
+		fprintf(file, "  },\n");
+	}
+	fprintf(file, "  \"wall_seconds\": %.6f,\n", wall_seconds);
+	fprintf(file, "  \"mips\": %.3f\n", (wall_seconds > 0.0) ? (f64) cpu->retired / wall_seconds / 1000000.0 : 0.0);
+	fprintf(file, "}\n");
+
+	fclose(file);
+	return 1;
+}
+
+s32 heatmap_init(cpu_t* cpu, u32 granule, u64 sample_interval) {
+	heatmap_t* heatmap = &cpu->heatmap;
+	heatmap->granule_shift = 0;
+	while ((1u << heatmap->granule_shift) < granule) {
+		++heatmap->granule_shift;
+	}
+
+	heatmap->granule_count = (u32) (((u64) cpu->memory.size + granule - 1) >> heatmap->granule_shift);
+	heatmap->loads = (u64*) calloc(heatmap->granule_count, sizeof(u64));
+	heatmap->stores = (u64*) calloc(heatmap->granule_count, sizeof(u64));
+	heatmap->touched = (u8*) calloc(heatmap->granule_count, sizeof(u8));
+	if (heatmap->loads == NULL || heatmap->stores == NULL || heatmap->touched == NULL) {
+		printf("Failed to allocate memory for heatmap\n");
+		return 0;
+	}
+
+	heatmap->sample_interval = sample_interval;
+	heatmap->next_sample = sample_interval;
+	heatmap->stack_lowest = 0xFFFFFFFF;
+	heatmap->stack_highest = 0;
+	heatmap->enabled = 1;
+	return 1;
+}
+
+void heatmap_sample(cpu_t* cpu) {
+	heatmap_t* heatmap = &cpu->heatmap;
+	heatmap->next_sample += heatmap->sample_interval;
+
+	if (heatmap->sample_count == heatmap->sample_capacity) {
+		usize capacity = (heatmap->sample_capacity == 0) ? 256 : heatmap->sample_capacity * 2;
+		void* p = realloc(heatmap->samples, capacity * sizeof(u32));
+		if (p == NULL) {
+			printf("Failed to allocate memory for heatmap samples\n");
+			heatmap->next_sample = (u64) -1;
+			return;
+		}
+
+		heatmap->samples = (u32*) p;
+		heatmap->sample_capacity = capacity;
+	}
+
+	heatmap->samples[heatmap->sample_count++] = heatmap->touched_count;
+	memset(heatmap->touched, 0, heatmap->granule_count);
+	heatmap->touched_count = 0;
+}
+
+void write_u32(FILE* file, u32 value) {
+	fwrite(&value, sizeof(u32), 1, file);
+}
+
+/*
+ * little-endian layout:
+ *   u32 magic 'K32H', u32 version, u32 granule size, u32 granule count
+ *   u64 retired instructions, u64 sample interval, u32 sample count
+ *   u32 lowest stack pointer, u32 highest stack pointer
+ *   u32 loads[granule count], u32 stores[granule count] (saturating)
+ *   u32 working set granules[sample count]
+ */
+s32 heatmap_write(cpu_t* cpu, char* path) {
+	heatmap_t* heatmap = &cpu->heatmap;
+	if (heatmap->touched_count != 0) {
+		heatmap_sample(cpu);
+	}
+
+	FILE* file = fopen(path, "wb");
+	if (file == NULL) {
+		printf("Failed to open heatmap file: %s\n", path);
+		return 0;
+	}
+
+	u32 granule = 1u << heatmap->granule_shift;
+	write_u32(file, HEATMAP_MAGIC);
+	write_u32(file, HEATMAP_VERSION);
+	write_u32(file, granule);
+	write_u32(file, heatmap->granule_count);
+	fwrite(&cpu->retired, sizeof(u64), 1, file);
+	fwrite(&heatmap->sample_interval, sizeof(u64), 1, file);
+	write_u32(file, (u32) heatmap->sample_count);
+	write_u32(file, heatmap->stack_lowest);
+	write_u32(file, heatmap->stack_highest);
+
+	for (u32 i = 0; i < heatmap->granule_count; ++i) {
+		write_u32(file, (heatmap->loads[i] > 0xFFFFFFFF) ? 0xFFFFFFFF : (u32) heatmap->loads[i]);
+	}
+
+	for (u32 i = 0; i < heatmap->granule_count; ++i) {
+		write_u32(file, (heatmap->stores[i] > 0xFFFFFFFF) ? 0xFFFFFFFF : (u32) heatmap->stores[i]);
+	}
+
+	if (heatmap->sample_count != 0 && fwrite(heatmap->samples, sizeof(u32), heatmap->sample_count, file) != heatmap->sample_count) {
+		printf("Failed to write heatmap file: %s\n", path);
+		fclose(file);
+		return 0;
+	}
+
+	fclose(file);
+
+	/* summary: hottest granules, working set and how much of -m was actually used */
+	u32 hot[HEATMAP_HOT_COUNT];
+	u32 hot_count = 0;
+	u32 used = 0;
+	u32 highest_touched = 0;
+	for (u32 i = 0; i < heatmap->granule_count; ++i) {
+		u64 total = heatmap->loads[i] + heatmap->stores[i];
+		if (total == 0) {
+			continue;
+		}
+
+		++used;
+		highest_touched = i;
+
+		u32 position = hot_count;
+		while (position > 0 && heatmap->loads[hot[position - 1]] + heatmap->stores[hot[position - 1]] < total) {
+			--position;
+		}
+
+		if (position >= HEATMAP_HOT_COUNT) {
+			continue;
+		}
+
+		u32 last = (hot_count < HEATMAP_HOT_COUNT) ? hot_count : HEATMAP_HOT_COUNT - 1;
+		for (u32 j = last; j > position; --j) {
+			hot[j] = hot[j - 1];
+		}
+		hot[position] = i;
+		if (hot_count < HEATMAP_HOT_COUNT) {
+			++hot_count;
+		}
+	}
+
+	u32 peak = 0;
+	u64 sum = 0;
+	for (usize i = 0; i < heatmap->sample_count; ++i) {
+		sum += heatmap->samples[i];
+		if (heatmap->samples[i] > peak) {
+			peak = heatmap->samples[i];
+		}
+	}
+
+	printf("Heatmap (%u byte granules) written to %s\n", granule, path);
+	printf("Hot granules:\n");
+	for (u32 i = 0; i < hot_count; ++i) {
+		u32 index = hot[i];
+		/* shifted in 64 bits, the last granule can reach past 4G and is cut at the end of memory */
+		u64 end = ((u64) index + 1) << heatmap->granule_shift;
+		if (end > cpu->memory.size) {
+			end = cpu->memory.size;
+		}
+
+		printf("  0x%08x-0x%08x  loads: %llu  stores: %llu\n", (u32) ((u64) index << heatmap->granule_shift), (u32) (end - 1),
+			(unsigned long long) heatmap->loads[index], (unsigned long long) heatmap->stores[index]);
+	}
+
+	u64 suggested = (used == 0) ? 0 : ((u64) highest_touched + 1) << heatmap->granule_shift;
+	if (suggested > cpu->memory.size) {
+		suggested = cpu->memory.size;
+	}
+	printf("Granules touched: %u of %u (suggested -m 0x%08x)\n", used, heatmap->granule_count, (u32) suggested);
+	if (heatmap->sample_count != 0) {
+		printf("Working set per %llu instructions: peak %u granules (%llu bytes), average %.1f granules\n", (unsigned long long) heatmap->sample_interval,
+			peak, (unsigned long long) peak << heatmap->granule_shift, (f64) sum / (f64) heatmap->sample_count);
+	}
+
+	if (heatmap->stack_highest >= heatmap->stack_lowest && heatmap->stack_lowest != 0xFFFFFFFF) {
+		printf("Stack: lowest sp 0x%08x, highest sp 0x%08x, high-water depth %u bytes\n", heatmap->stack_lowest, heatmap->stack_highest, heatmap->stack_highest - heatmap->stack_lowest);
+	}
+
+	return 1;
+}
+
+/* '<a>:<b>:<c>', each a decimal number with an optional K (1024) suffix */
+s32 parse_geometry(char* str, u32 out[3]) {
+	char* p = str;
+	for (u32 i = 0; i < 3; ++i) {
+		if (!is_decimal(*p)) {
+			return 0;
+		}
+
+		u64 value = 0;
+		while (is_decimal(*p)) {
+			value = value * 10 + decchar_to_u32(*p);
+			++p;
+		}
+
+		if (*p == 'K') {
+			value *= 1024;
+			++p;
+		}
+
+		if (value == 0 || value > 0x80000000) {
+			return 0;
+		}
+
+		out[i] = (u32) value;
+		if (i < 2 && *p++ != ':') {
+			return 0;
+		}
+	}
+
+	return *p == '\0';
+}
+
+s32 cache_init(cpu_t* cpu, cache_kind_t kind, char* geometry) {
+	static char* const usages[CACHE_KIND_COUNT] = { "<size>:<ways>:<line bytes>", "<size>:<ways>:<line bytes>", "<entries>:<ways>:<page bytes>" };
+	u32 values[3];
+	if (!parse_geometry(geometry, values)) {
+		printf("Invalid cache geometry '%s', expected %s\n", geometry, usages[kind]);
+		return 0;
+	}
+
+	/* a cache is described by its size in bytes, a TLB by its entry count */
+	u32 ways = values[1];
+	u32 line = values[2];
+	u32 lines = (kind == CACHE_TLB) ? values[0] : values[0] / line;
+	if ((line & (line - 1)) != 0 || lines == 0 || (kind != CACHE_TLB && values[0] % line != 0) || lines % ways != 0 || ((lines / ways) & (lines / ways - 1)) != 0) {
+		printf("Invalid cache geometry '%s', line size and set count must be powers of two\n", geometry);
+		return 0;
+	}
+
+	cache_t* cache = &cpu->cache.caches[kind];
+	cache->set_count = lines / ways;
+	cache->ways = ways;
+	cache->line_shift = 0;
+	while ((1u << cache->line_shift) < line) {
+		++cache->line_shift;
+	}
+
+	cache->tags = (u32*) malloc((usize) lines * sizeof(u32));
+	if (cache->tags == NULL) {
+		printf("Failed to allocate memory for cache model\n");
+		return 0;
+	}
+
+	/* no line number reaches 0xFFFFFFFF in guest memory, so it marks an empty way */
+	memset(cache->tags, 0xFF, (usize) lines * sizeof(u32));
+	cache->enabled = 1;
+	cpu->cache.enabled = 1;
+	return 1;
+}
+
+u32 cache_function(cache_model_t* model, u32 address) {
+	u32 mask = model->function_capacity - 1;
+	u32 slot = (address * 0x9E3779B1) & mask;
+	while (model->function_slots[slot] != 0) {
+		u32 index = model->function_slots[slot] - 1;
+		if (model->functions[index].address == address) {
+			return index;
+		}
+		slot = (slot + 1) & mask;
+	}
+
+	if (model->function_count * 2 >= model->function_capacity) {
+		u32 capacity = model->function_capacity * 2;
+		void* functions = realloc(model->functions, (usize) capacity * sizeof(cache_bucket_t));
+		u32* slots = (u32*) calloc(capacity, sizeof(u32));
+		if (functions == NULL || slots == NULL) {
+			/* keep counting into the current function rather than losing the run */
+			free(slots);
+			if (functions != NULL) {
+				model->functions = (cache_bucket_t*) functions;
+			}
+			return model->current_function;
+		}
+
+		model->functions = (cache_bucket_t*) functions;
+		free(model->function_slots);
+		model->function_slots = slots;
+		model->function_capacity = capacity;
+		mask = capacity - 1;
+		for (u32 i = 0; i < model->function_count; ++i) {
+			u32 rehash = (model->functions[i].address * 0x9E3779B1) & mask;
+			while (slots[rehash] != 0) {
+				rehash = (rehash + 1) & mask;
+			}
+			slots[rehash] = i + 1;
+		}
+
+		slot = (address * 0x9E3779B1) & mask;
+		while (slots[slot] != 0) {
+			slot = (slot + 1) & mask;
+		}
+	}
+
+	u32 index = model->function_count++;
+	memset(&model->functions[index], 0, sizeof(cache_bucket_t));
+	model->functions[index].address = address;
+	model->function_slots[slot] = index + 1;
+	return index;
+}
+
+s32 cache_model_init(cpu_t* cpu) {
+	cache_model_t* model = &cpu->cache;
+	if (!model->enabled) {
+		return 1;
+	}
+
+	model->range_count = (u32) (((u64) cpu->memory.size + (1u << CACHE_RANGE_SHIFT) - 1) >> CACHE_RANGE_SHIFT);
+	model->ranges = (cache_bucket_t*) calloc(model->range_count, sizeof(cache_bucket_t));
+	model->function_capacity = 64;
+	model->functions = (cache_bucket_t*) malloc(model->function_capacity * sizeof(cache_bucket_t));
+	model->function_slots = (u32*) calloc(model->function_capacity, sizeof(u32));
+	if (model->ranges == NULL || model->functions == NULL || model->function_slots == NULL) {
+		printf("Failed to allocate memory for cache model\n");
+		return 0;
+	}
+
+	for (u32 i = 0; i < model->range_count; ++i) {
+		model->ranges[i].address = i << CACHE_RANGE_SHIFT;
+	}
+
+	/* everything before the first link is attributed to the boot vector */
+	model->current_function = cache_function(model, cpu->boot_vector);
+	return 1;
+}
+
+s32 cache_lookup(cache_t* cache, u32 line) {
+	u32* set = &cache->tags[(line & (cache->set_count - 1)) * cache->ways];
+	u32 way = 0;
+	while (way < cache->ways && set[way] != line) {
+		++way;
+	}
+
+	s32 hit = way < cache->ways;
+	if (!hit) {
+		way = cache->ways - 1;
+	}
+
+	memmove(&set[1], &set[0], way * sizeof(u32));
+	set[0] = line;
+	if (hit) {
+		++cache->hits;
+	} else {
+		++cache->misses;
+	}
+	return hit;
+}
+
+void cache_count(cpu_t* cpu, cache_kind_t kind, u32 address, s32 hit) {
+	cache_model_t* model = &cpu->cache;
+	cache_bucket_t* function = &model->functions[model->current_function];
+	cache_bucket_t* range = ((address >> CACHE_RANGE_SHIFT) < model->range_count) ? &model->ranges[address >> CACHE_RANGE_SHIFT] : NULL;
+	if (hit) {
+		++function->hits[kind];
+		if (range != NULL) {
+			++range->hits[kind];
+		}
+	} else {
+		++function->misses[kind];
+		if (range != NULL) {
+			++range->misses[kind];
+		}
+	}
+}
+
+/* stores allocate like loads, an access crossing a line boundary touches every line it covers */
+void cache_access(cpu_t* cpu, cache_kind_t kind, u32 address, u32 size) {
+	cache_model_t* model = &cpu->cache;
+	cache_t* cache = &model->caches[kind];
+	if (cache->enabled) {
+		u32 last = (address + size - 1) >> cache->line_shift;
+		for (u32 line = address >> cache->line_shift; line <= last; ++line) {
+			cache_count(cpu, kind, line << cache->line_shift, cache_lookup(cache, line));
+		}
+	}
+
+	cache_t* tlb = &model->caches[CACHE_TLB];
+	if (tlb->enabled) {
+		u32 last = (address + size - 1) >> tlb->line_shift;
+		for (u32 page = address >> tlb->line_shift; page <= last; ++page) {
+			cache_count(cpu, CACHE_TLB, page << tlb->line_shift, cache_lookup(tlb, page));
+		}
+	}
+}
+
+void cache_enter(cpu_t* cpu, u32 address) {
+	cache_model_t* model = &cpu->cache;
+	u32 capacity = sizeof(model->call_stack) / sizeof(model->call_stack[0]);
+	/* past the shadow stack depth, calls are attributed to the deepest recorded function */
+	if (model->call_depth < capacity) {
+		model->call_stack[model->call_depth] = model->current_function;
+		model->current_function = cache_function(model, address);
+	}
+	++model->call_depth;
+}
+
+void cache_leave(cpu_t* cpu) {
+	cache_model_t* model = &cpu->cache;
+	u32 capacity = sizeof(model->call_stack) / sizeof(model->call_stack[0]);
+	if (model->call_depth == 0) {
+		return;
+	}
+
+	--model->call_depth;
+	if (model->call_depth < capacity) {
+		model->current_function = model->call_stack[model->call_depth];
+	}
+}
+
+u64 cache_bucket_misses(cache_bucket_t* bucket) {
+	return bucket->misses[CACHE_INSTRUCTION] + bucket->misses[CACHE_DATA] + bucket->misses[CACHE_TLB];
+}
+
+int compare_cache_buckets(const void* a, const void* b) {
+	u64 misses_a = cache_bucket_misses(*(cache_bucket_t**) a);
+	u64 misses_b = cache_bucket_misses(*(cache_bucket_t**) b);
+	return (misses_a < misses_b) - (misses_a > misses_b);
+}
+
+void print_cache_rates(cpu_t* cpu, cache_bucket_t* bucket) {
+	static char* const names[CACHE_KIND_COUNT] = { "icache", "dcache", "tlb" };
+	for (u32 i = 0; i < CACHE_KIND_COUNT; ++i) {
+		if (!cpu->cache.caches[i].enabled) {
+			continue;
+		}
+
+		u64 total = bucket->hits[i] + bucket->misses[i];
+		printf("  %s %8llu/%-8llu %6.2f%%", names[i], (unsigned long long) bucket->misses[i], (unsigned long long) total,
+			(total == 0) ? 0.0 : 100.0 * (f64) bucket->misses[i] / (f64) total);
+	}
+	printf("\n");
+}
+
+void print_cache_buckets(cpu_t* cpu, cache_bucket_t* buckets, u32 count, s32 ranges) {
+	cache_bucket_t** sorted = (cache_bucket_t**) malloc((usize) count * sizeof(cache_bucket_t*));
+	if (sorted == NULL) {
+		return;
+	}
+
+	u32 used = 0;
+	for (u32 i = 0; i < count; ++i) {
+		cache_bucket_t* bucket = &buckets[i];
+		u64 total = cache_bucket_misses(bucket);
+		for (u32 j = 0; j < CACHE_KIND_COUNT; ++j) {
+			total += bucket->hits[j];
+		}
+
+		if (total != 0) {
+			sorted[used++] = bucket;
+		}
+	}
+
+	qsort(sorted, used, sizeof(cache_bucket_t*), compare_cache_buckets);
+	for (u32 i = 0; i < used && i < CACHE_REPORT_COUNT; ++i) {
+		if (ranges) {
+			printf("  0x%08x-0x%08x", sorted[i]->address, sorted[i]->address + (1u << CACHE_RANGE_SHIFT) - 1);
+		} else {
+			printf("  0x%08x", sorted[i]->address);
+		}
+		print_cache_rates(cpu, sorted[i]);
+	}
+
+	if (used > CACHE_REPORT_COUNT) {
+		printf("  ... %u more\n", used - CACHE_REPORT_COUNT);
+	}
+	free(sorted);
+}
+
+void cache_report(cpu_t* cpu) {
+	static char* const names[CACHE_KIND_COUNT] = { "icache", "dcache", "tlb" };
+	cache_model_t* model = &cpu->cache;
+	printf("Cache model (misses/accesses):\n");
+	for (u32 i = 0; i < CACHE_KIND_COUNT; ++i) {
+		cache_t* cache = &model->caches[i];
+		if (!cache->enabled) {
+			continue;
+		}
+
+		u64 total = cache->hits + cache->misses;
+		u32 line = 1u << cache->line_shift;
+		if (i == CACHE_TLB) {
+			printf("  %-6s %u entries, %u-way, %u byte pages", names[i], cache->set_count * cache->ways, cache->ways, line);
+		} else {
+			printf("  %-6s %u bytes, %u-way, %u byte lines", names[i], cache->set_count * cache->ways * line, cache->ways, line);
+		}
+		printf(": %llu/%llu (%.2f%% miss)\n", (unsigned long long) cache->misses, (unsigned long long) total,
+			(total == 0) ? 0.0 : 100.0 * (f64) cache->misses / (f64) total);
+	}
+
+	printf("Functions by entry address, most misses first:\n");
+	print_cache_buckets(cpu, model->functions, model->function_count, 0);
+	printf("Address ranges, most misses first:\n");
+	print_cache_buckets(cpu, model->ranges, model->range_count, 1);
+}
+
+u64 counter_to_ns(u64 ticks) {
+	return (u64) ((f64) ticks * 1000000000.0 / (f64) SDL_GetPerformanceFrequency());
+}
+
+void histogram_add(histogram_t* histogram, u64 value) {
+	u32 index = (u32) value;
+	if (value >= (1u << HISTOGRAM_SUB_BITS)) {
+		u32 exponent = HISTOGRAM_SUB_BITS;
+		while ((value >> (exponent + 1)) != 0) {
+			++exponent;
+		}
+
+		u32 mantissa = (u32) (value >> (exponent - HISTOGRAM_SUB_BITS)) & ((1u << HISTOGRAM_SUB_BITS) - 1);
+		index = ((exponent - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS) + mantissa;
+	}
+
+	++histogram->counts[index];
+	++histogram->count;
+	if (value > histogram->max) {
+		histogram->max = value;
+	}
+}
+
+/* upper bound of the bucket holding the given fraction of samples, clamped to the maximum seen */
+u64 histogram_percentile(histogram_t* histogram, f64 fraction) {
+	if (histogram->count == 0) {
+		return 0;
+	}
+
+	u64 rank = (u64) ((f64) histogram->count * fraction);
+	if (rank >= histogram->count) {
+		rank = histogram->count - 1;
+	}
+
+	u64 seen = 0;
+	u32 index = 0;
+	for (; index < HISTOGRAM_BUCKET_COUNT; ++index) {
+		seen += histogram->counts[index];
+		if (seen > rank) {
+			break;
+		}
+	}
+
+	u64 upper = index;
+	if (index >= (1u << HISTOGRAM_SUB_BITS)) {
+		u32 exponent = (index >> HISTOGRAM_SUB_BITS) + HISTOGRAM_SUB_BITS - 1;
+		u64 mantissa = (index & ((1u << HISTOGRAM_SUB_BITS) - 1)) + (1u << HISTOGRAM_SUB_BITS);
+		upper = ((mantissa + 1) << (exponent - HISTOGRAM_SUB_BITS)) - 1;
+	}
+
+	return (upper < histogram->max) ? upper : histogram->max;
+}
+
+char* format_ns(char* buffer, usize size, u64 ns) {
+	if (ns < 10000) {
+		snprintf(buffer, size, "%lluns", (unsigned long long) ns);
+	} else if (ns < 10000000) {
+		snprintf(buffer, size, "%.1fus", (f64) ns / 1000.0);
+	} else {
+		snprintf(buffer, size, "%.1fms", (f64) ns / 1000000.0);
+	}
+	return buffer;
+}
+
+void print_histogram(char* name, histogram_t* histogram) {
+	char p50[32];
+	char p99[32];
+	char max[32];
+	if (histogram->count == 0) {
+		printf("  %-28s no samples\n", name);
+		return;
+	}
+
+	printf("  %-28s %10s %10s %10s %10llu\n", name, format_ns(p50, sizeof(p50), histogram_percentile(histogram, 0.5)),
+		format_ns(p99, sizeof(p99), histogram_percentile(histogram, 0.99)), format_ns(max, sizeof(max), histogram->max), (unsigned long long) histogram->count);
+}
+
+void latency_report(cpu_t* cpu) {
+	latency_t* latency = &cpu->latency;
+	printf("Latency:%-22s %10s %10s %10s %10s\n", "", "p50", "p99", "max", "samples");
+	print_histogram("input event to handler", &latency->input);
+	print_histogram("guest interrupt handler", &latency->handler);
+	print_histogram("frame present", &latency->present);
+	print_histogram("frame interval", &latency->frame_interval);
+}
+
+/* the framebuffer is guest memory, so the overlay goes in the title instead of over the picture */
+void latency_overlay(cpu_t* cpu, char* title) {
+	latency_t* latency = &cpu->latency;
+	char buffer[256];
+	char input[32];
+	char handler[32];
+	snprintf(buffer, sizeof(buffer), "%s | input p99 %s | handler p99 %s | present %.2fms | frame %.1fms", title,
+		format_ns(input, sizeof(input), histogram_percentile(&latency->input, 0.99)),
+		format_ns(handler, sizeof(handler), histogram_percentile(&latency->handler, 0.99)),
+		(f64) SDL_AtomicGet(&latency->last_present_us) / 1000.0, (f64) SDL_AtomicGet(&latency->last_interval_us) / 1000.0);
+	SDL_SetWindowTitle(cpu->graphical.window, buffer);
+}
+
+s32 trace_flush(trace_t* trace) {
+	u32 head = (u32) SDL_AtomicGet(&trace->head);
+	SDL_MemoryBarrierAcquire();
+	u32 tail = (u32) SDL_AtomicGet(&trace->tail);
+	if (head == tail) {
+		return 0;
+	}
+
+	/* at most two runs, split where the ring wraps */
+	u32 start = tail & (TRACE_RING_SIZE - 1);
+	u32 count = head - tail;
+	u32 first = (start + count > TRACE_RING_SIZE) ? TRACE_RING_SIZE - start : count;
+	fwrite(&trace->ring[start], sizeof(trace_record_t), first, trace->file);
+	if (first < count) {
+		fwrite(&trace->ring[0], sizeof(trace_record_t), count - first, trace->file);
+	}
+
+	trace->written += count;
+	SDL_MemoryBarrierRelease();
+	SDL_AtomicSet(&trace->tail, (int) head);
+	return 1;
+}
+
+s32 trace_thread(void* param) {
+	trace_t* trace = (trace_t*) param;
+	while (!SDL_AtomicGet(&trace->stop)) {
+		if (!trace_flush(trace)) {
+			SDL_Delay(TRACE_FLUSH_MS);
+		}
+	}
+
+	while (trace_flush(trace)) {
+	}
+	return 0;
+}
+
+s32 trace_open(cpu_t* cpu, char* path) {
+	trace_t* trace = &cpu->trace;
+	trace->file = fopen(path, "wb");
+	if (trace->file == NULL) {
+		printf("Failed to open trace file: %s\n", path);
+		return 0;
+	}
+
+	trace->ring = (trace_record_t*) malloc(TRACE_RING_SIZE * sizeof(trace_record_t));
+	if (trace->ring == NULL) {
+		printf("Failed to allocate memory for trace ring\n");
+		fclose(trace->file);
+		return 0;
+	}
+
+	u32 header[4] = { TRACE_MAGIC, TRACE_VERSION, sizeof(trace_record_t), 0 };
+	fwrite(header, sizeof(header), 1, trace->file);
+
+	trace->thread = SDL_CreateThread(trace_thread, "k32-trace", trace);
+	if (trace->thread == NULL) {
+		printf("Failed to create trace thread: %s\n", SDL_GetError());
+		free(trace->ring);
+		fclose(trace->file);
+		return 0;
+	}
+
+	trace->enabled = 1;
+	return 1;
+}
+
+void trace_close(cpu_t* cpu) {
+	trace_t* trace = &cpu->trace;
+	SDL_AtomicSet(&trace->stop, 1);
+	SDL_WaitThread(trace->thread, NULL);
+
+	/* the last header word holds the total drop count, which includes drops after the final record */
+	u32 dropped = (trace->dropped > 0xFFFFFFFF) ? 0xFFFFFFFF : (u32) trace->dropped;
+	if (fseek(trace->file, 3 * sizeof(u32), SEEK_SET) == 0) {
+		fwrite(&dropped, sizeof(u32), 1, trace->file);
+	}
+	fclose(trace->file);
+	free(trace->ring);
+	trace->enabled = 0;
+	printf("Tracepoints: %llu written, %llu dropped\n", (unsigned long long) trace->written, (unsigned long long) trace->dropped);
+}
@@ -8,6 +8,20 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+/* glibc only exposes it with _XOPEN_SOURCE, 1024 is the Linux and BSD limit */
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+#endif
+
 typedef uint8_t u8;
 typedef uint16_t u16;
 typedef uint32_t u32;
@@ -23,6 +37,47 @@ typedef double f64;
 
 typedef size_t usize;
 
+/* minimal threading wrappers for parsing and relocating objects in parallel */
+#ifdef _WIN32
+#include <windows.h>
+typedef HANDLE thread_t;
+typedef CRITICAL_SECTION mutex_t;
+#define THREAD_RESULT DWORD WINAPI
+
+s32 thread_start(thread_t* thread, LPTHREAD_START_ROUTINE function, void* data) {
+	*thread = CreateThread(NULL, 0, function, data, 0, NULL);
+	return *thread != NULL;
+}
+
+void thread_join(thread_t thread) {
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+}
+
+void mutex_init(mutex_t* mutex) { InitializeCriticalSection(mutex); }
+void mutex_destroy(mutex_t* mutex) { DeleteCriticalSection(mutex); }
+void mutex_lock(mutex_t* mutex) { EnterCriticalSection(mutex); }
+void mutex_unlock(mutex_t* mutex) { LeaveCriticalSection(mutex); }
+#else
+#include <pthread.h>
+typedef pthread_t thread_t;
+typedef pthread_mutex_t mutex_t;
+#define THREAD_RESULT void*
+
+s32 thread_start(thread_t* thread, void* (*function)(void*), void* data) {
+	return pthread_create(thread, NULL, function, data) == 0;
+}
+
+void thread_join(thread_t thread) {
+	pthread_join(thread, NULL);
+}
+
+void mutex_init(mutex_t* mutex) { pthread_mutex_init(mutex, NULL); }
+void mutex_destroy(mutex_t* mutex) { pthread_mutex_destroy(mutex); }
+void mutex_lock(mutex_t* mutex) { pthread_mutex_lock(mutex); }
+void mutex_unlock(mutex_t* mutex) { pthread_mutex_unlock(mutex); }
+#endif
+
 typedef struct {
 	char magic[4]; /* ELF + 0x7F */
 	u8 class; /* 0x01 (32-bit) */
@@ -76,9 +131,24 @@ typedef struct {
 
 typedef struct {
 	u32 offset;
-	u32 info;
+	u32 info; /* symbol index << 8 | type */
 } elf_relocation_t;
 
+/*
+ * the only relocation type k32-as emits: the word becomes S + (stored word - provisional address of S),
+ * where the provisional address is the symbol's section sh_addr + st_value in its object (0 when undefined)
+ */
+#define R_KR32_32 0x01
+
+typedef struct {
+	u32 name_offset;
+	u32 value;
+	u32 size;
+	u8 info;
+	u8 other;
+	u16 section_index;
+} elf_symbol_t;
+
 typedef struct {
 	elf_header_t header;
 	elf_program_header_t program_header;
@@ -245,16 +315,12 @@ s32 parse_elf(u8* buffer, usize size, elf_t* elf) {
 		return 0;
 	}
 
-	if (elf->program_header.vaddress != 0x00000000) {
-		printf("Invalid program header virtual address\n");
-		return 0;
-	}
-
-	if (elf->program_header.flags != 0x00) {
+	/* the address the object was assembled for does not matter, every reference to it is relocated. k32-as writes r-x and 4 */
+	if (elf->program_header.flags != 0x00 && elf->program_header.flags != 0x05) {
 		printf("Warning: ignoring program header flags\n");
 	}
 
-	if (elf->program_header.align != 0x00) {
+	if (elf->program_header.align != 0x00 && elf->program_header.align != 0x04) {
 		printf("Warning: ignoring program header alignment\n");
 	}
 
@@ -286,239 +352,1738 @@ void hexdump(u8* buffer, usize size) {
 	}
 }
 
-int main(int argc, char** argv) {
-	s32 base_set = 0;
-	u32 base_address = 0;
+#define NO_OUTPUT 0xFFFFFFFF
 
-	const char* elf_file = NULL;
-	const char* out_file = NULL;
+typedef struct {
+	usize object;
+	usize section;
+} section_ref_t;
+
+/*
+ * one input object, its buffer stays alive until the image is written since names point into it and the
+ * output is gathered straight from its sections. it is mapped copy-on-write so relocations patch it in place
+ * without touching the file, only the pages holding relocated words get private copies
+ */
+typedef struct {
+	const char* path;
+	u8* buffer;
+	usize size;
+#ifdef _WIN32
+	s32 is_allocated;
+#else
+	s32 is_mapped;
+#endif
+	elf_t elf;
+	elf_section_header_t* headers;
+	char* section_names;
 
-	s32 ofile_malloced = 0;
+	elf_symbol_t* symbols;
+	usize symbol_count;
+	char* symbol_names;
 
-	#ifdef DEBUG_FIXED_FILES
-	elf_file = "../../../../assembler/test.elf";
-	out_file = "../../../test.bin";
-	#else
-	if (argc < 2) {
-		printf("Usage: %s <source file> [options]\n", argv[0]);
-		printf("Flags:\n  [-o], [/Fo]\n    <output file>  Output file\n  [--base], [/B]\n    <32-bit address> Base address to relocate to\n");
-		return 1;
-	}
-	#endif
+	u32* output_sections; /* per input section, index of the output section it is merged into or NO_OUTPUT */
+	u32* offsets; /* per input section, where its bytes start within the output section */
+	u8* live; /* per input section, cleared by --gc-sections when nothing reachable refers to it */
+	u64* heat; /* per input section, execution count from --layout-profile, NULL without one */
+	section_ref_t* folded; /* per input section, the identical section --icf kept in its place (section 0 if none), NULL without --icf */
+} object_t;
 
-	for (usize i = 1; i < argc; ++i) {
-		if (strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "/Fo") == 0) {
-			if (i + 1 >= argc) {
-				printf("Expected output file after -o\n");
-				return 1;
-			}
+typedef struct {
+	const char* name;
+	u32 size;
+	u32 address;
+	u32 align; /* largest sh_addralign of the sections merged into it */
+	s32 has_start; /* placed by --section-start instead of following the previous section */
+	u32 start;
+} output_section_t;
 
-			out_file = argv[i + 1];
-			++i;
-		} else if (strcmp(argv[i], "--base") == 0 || strcmp(argv[i], "/B") == 0) {
-			if (i + 1 >= argc) {
-				printf("Expected base address after --base\n");
-				return 1;
-			}
+typedef struct {
+	const char* name;
+	u32 address;
+	s32 used;
+} section_start_t;
 
-			char* base_str = argv[i + 1];
-			usize len = strlen(base_str);
+/* --sparse image layout, k32-emu recognises the magic and loads only the segments */
+#define SPARSE_MAGIC "K32S"
+#define SPARSE_VERSION 1
+/* gaps up to this many bytes between sections are stored as zeros instead of starting a new segment */
+#define SPARSE_MAX_GAP 0x1000
 
-			u32(*char_to_u32)(char) = decchar_to_u32;
-			u32 radix = 10;
-			u32 start = 0;
-			if (len > 2 && base_str[0] == '0' && base_str[1] == 'x') {
-				char_to_u32 = hexchar_to_u32;
-				radix = 16;
-				start = 2;
-			}
+typedef struct {
+	u8 magic[4];
+	u16 version;
+	u16 segment_count;
+	u32 entry;
+	u32 reserved;
+} sparse_header_t;
 
-			u64 value = 0;
-			for (usize i = start; i < len; ++i) {
-				value = (value * radix) + char_to_u32(base_str[i]);
-			}
+/* bytes past file_size up to memory_size are zero when loaded */
+typedef struct {
+	u32 address;
+	u32 offset;
+	u32 file_size;
+	u32 memory_size;
+} sparse_segment_t;
 
-			if (value > 0xFFFFFFFF) {
-				printf("Warning: Base address is larger than 32-bits, truncating value\n");
+typedef struct {
+	const char* name;
+	usize object;
+	usize symbol;
+} global_t;
+
+/* open addressing over global symbols keyed on the full name, name == NULL marks an empty slot */
+typedef struct {
+	global_t* slots;
+	usize capacity;
+	usize count;
+} global_table_t;
+
+/* one input section placed in the image, kept sorted by output section and then by offset */
+typedef struct {
+	usize object;
+	usize section;
+	u32 output;
+	u32 order; /* position in command line order, the entry section is always 0 */
+	u64 heat;
+} contribution_t;
+
+typedef struct {
+	object_t* objects;
+	usize object_count;
+	output_section_t* sections;
+	usize section_count;
+	contribution_t* contributions;
+	usize contribution_count;
+	section_start_t* starts;
+	usize start_count;
+	global_table_t globals;
+} linker_t;
+
+typedef s32 (*job_function_t)(linker_t* linker, usize index);
+
+typedef struct {
+	linker_t* linker;
+	job_function_t function;
+	usize count;
+	usize next;
+	s32 failed;
+	mutex_t lock;
+} job_queue_t;
+
+THREAD_RESULT worker(void* data) {
+	job_queue_t* queue = (job_queue_t*) data;
+	while (1) {
+		mutex_lock(&queue->lock);
+		usize index = queue->next++;
+		mutex_unlock(&queue->lock);
+
+		if (index >= queue->count) {
+			break;
+		}
+
+		if (!queue->function(queue->linker, index)) {
+			mutex_lock(&queue->lock);
+			queue->failed = 1;
+			mutex_unlock(&queue->lock);
+		}
+	}
+
+	return 0;
+}
+
+/* runs function for every index on up to thread_count threads, returns 0 if any call failed */
+s32 run_jobs(linker_t* linker, job_function_t function, usize count, u32 thread_count) {
+	job_queue_t queue = { .linker = linker, .function = function, .count = count, .next = 0, .failed = 0 };
+	mutex_init(&queue.lock);
+	if (thread_count > count) {
+		thread_count = (u32) count;
+	}
+
+	u32 started = 0;
+	thread_t* threads = NULL;
+	if (thread_count > 1) {
+		threads = (thread_t*) malloc(sizeof(thread_t) * thread_count);
+		for (u32 i = 0; threads != NULL && i < thread_count; ++i) {
+			if (thread_start(&threads[started], worker, &queue)) {
+				++started;
 			}
-			base_address = (u32) value;
-			base_set = 1;
-			++i;
-		} else if (elf_file == NULL) {
-			elf_file = argv[i];
-		} else {
-			printf("Unknown argument (%u): '%s'\n", (u32) i, argv[i]);
-			return 1;
 		}
 	}
 
-	if (!base_set) {
-		printf("Warning: Base address not set, defaulting to 0x00000000\n");
-		base_address = 0;
+	if (started == 0) {
+		worker(&queue);
 	}
 
-	if (elf_file == NULL) {
-		printf("No source file specified\n");
-		return 1;
+	for (u32 i = 0; i < started; ++i) {
+		thread_join(threads[i]);
 	}
 
-	if (out_file == NULL) {
-		usize len = strlen(elf_file);
-		usize base_len = len;
-		char* ext = strrchr(elf_file, '.');
-		if (ext == NULL) {
-			len += 4;
-		} else {
-			base_len -= strlen(ext);
-			len = base_len + 4;
-		}
+	free(threads);
+	mutex_destroy(&queue.lock);
+	return !queue.failed;
+}
 
-		out_file = (char*) malloc(len + 1);
-		if (out_file == NULL) {
-			printf("Failed to allocate memory\n");
-			return 1;
-		}
+usize hash_string(const char* string) {
+	usize hash = 0;
+	while (*string != '\0') {
+		hash = (hash * 31) + *string;
+		string++;
+	}
 
-		strncpy((char*) out_file, elf_file, base_len);
-		strncpy((char*) &out_file[base_len], ".bin", 4);
-		((char*) out_file)[len] = '\0';
-		ofile_malloced = 1;
+	return hash;
+}
+
+global_t* global_slot(global_table_t* table, const char* name) {
+	usize mask = table->capacity - 1;
+	usize i = hash_string(name) & mask;
+	while (table->slots[i].name != NULL && strcmp(table->slots[i].name, name) != 0) {
+		i = (i + 1) & mask;
+	}
+
+	return &table->slots[i];
+}
+
+/* sections that only describe the object, everything else is part of the image */
+s32 is_metadata_section(const char* name) {
+	return strcmp(name, ".shstrtab") == 0 || strcmp(name, ".symtab") == 0 || strcmp(name, ".strtab") == 0 || strncmp(name, ".rel", 4) == 0 || strncmp(name, ".debug", 6) == 0 || strncmp(name, ".note", 5) == 0 || strncmp(name, ".comment", 8) == 0;
+}
+
+/* a name has to start and end inside its string table, a corrupt object could point anywhere */
+s32 is_valid_name(const char* table, usize table_size, u32 offset) {
+	return offset < table_size && memchr(&table[offset], '\0', table_size - offset) != NULL;
+}
+
+void close_object(object_t* object) {
+#ifdef _WIN32
+	if (object->is_allocated) {
+		free(object->buffer);
+	}
+#else
+	if (object->is_mapped) {
+		munmap(object->buffer, object->size);
 	}
+#endif
+	free(object->output_sections);
+	free(object->offsets);
+	free(object->live);
+	free(object->heat);
+	free(object->folded);
+}
 
-	FILE* elffp = fopen(elf_file, "rb");
+s32 load_object(linker_t* linker, usize index) {
+	object_t* object = &linker->objects[index];
+#ifdef _WIN32
+	FILE* elffp = fopen(object->path, "rb");
 	if (elffp == NULL) {
-		printf("Failed to open file: %s\n", elf_file);
-		return 1;
+		printf("Failed to open file: %s\n", object->path);
+		return 0;
 	}
 
 	fseek(elffp, 0, SEEK_END);
-	usize elf_size = ftell(elffp);
+	object->size = ftell(elffp);
 	fseek(elffp, 0, SEEK_SET);
 
-	if (elf_size < sizeof(elf_header_t)) {
-		printf("File is too small to be a valid ELF file\n");
+	if (object->size < sizeof(elf_header_t)) {
+		printf("%s: File is too small to be a valid ELF file\n", object->path);
 		fclose(elffp);
-		return 1;
+		return 0;
 	}
 
-	u8* elf_buffer = (u8*) malloc(elf_size);
-	if (elf_buffer == NULL) {
+	object->buffer = (u8*) malloc(object->size);
+	if (object->buffer == NULL) {
 		printf("Failed to allocate memory\n");
 		fclose(elffp);
-		return 1;
+		return 0;
 	}
 
-	if (fread(elf_buffer, 1, elf_size, elffp) != elf_size) {
-		printf("Failed to read file\n");
+	object->is_allocated = 1;
+	if (fread(object->buffer, 1, object->size, elffp) != object->size) {
+		printf("%s: Failed to read file\n", object->path);
 		fclose(elffp);
-		free(elf_buffer);
-		return 1;
+		return 0;
 	}
 
 	fclose(elffp);
+#else
+	int fd = open(object->path, O_RDONLY);
+	if (fd < 0) {
+		printf("Failed to open file: %s\n", object->path);
+		return 0;
+	}
 
-	elf_t elf;
-	if (!parse_elf(elf_buffer, elf_size, &elf)) {
-		printf("Failed to parse ELF file\n");
-		free(elf_buffer);
-		return 1;
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		printf("Failed to stat file: %s\n", object->path);
+		close(fd);
+		return 0;
 	}
 
-	// .text first, all other sections after (aside from NULL and .shstrtab)
-	usize out_buffer_size = 0;
-	u8* out_buffer = NULL;
+	object->size = (usize) st.st_size;
+	if (object->size < sizeof(elf_header_t)) {
+		printf("%s: File is too small to be a valid ELF file\n", object->path);
+		close(fd);
+		return 0;
+	}
+
+	void* p = mmap(NULL, object->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		printf("Failed to map file: %s\n", object->path);
+		return 0;
+	}
 
-	usize sh_offset = elf.header.shoffset;
-	elf_section_header_t* shstrstab_section = (elf_section_header_t*) &elf_buffer[sh_offset + (elf.header.shname_index * elf.header.shentry_size)];
-	usize shstrtab_offset = shstrstab_section->offset;
-	usize shstrtab_size = shstrstab_section->size;
-	usize shstrtab_index = 0;
+	object->buffer = (u8*) p;
+	object->is_mapped = 1;
+#endif
 
-	// find .text and put first in buffer
-	usize text_offset = 0;
-	usize text_size = 0;
-	for (usize i = 0; i < elf.header.shcount; ++i) {
-		elf_section_header_t* sh = (elf_section_header_t*) &elf_buffer[sh_offset + (i * elf.header.shentry_size)];
-		if (sh->name_offset == 0) {
-			continue;
+	if (!parse_elf(object->buffer, object->size, &object->elf)) {
+		printf("%s: Failed to parse ELF file\n", object->path);
+		return 0;
+	}
+
+	elf_header_t* header = &object->elf.header;
+	if ((usize) header->shoffset + (usize) header->shcount * header->shentry_size > object->size) {
+		printf("%s: Section headers are out of bounds\n", object->path);
+		return 0;
+	}
+
+	object->headers = (elf_section_header_t*) &object->buffer[header->shoffset];
+	for (usize i = 0; i < header->shcount; ++i) {
+		if ((usize) object->headers[i].offset + object->headers[i].size > object->size) {
+			printf("%s: Section %u is out of bounds\n", object->path, (u32) i);
+			return 0;
 		}
+	}
 
-		char* name = (char*) &elf_buffer[shstrtab_offset + sh->name_offset];
-		if (strcmp(name, ".text") == 0) {
-			text_offset = sh->offset;
-			text_size = sh->size;
-			break;
+	object->section_names = (char*) &object->buffer[object->headers[header->shname_index].offset];
+	for (usize i = 0; i < header->shcount; ++i) {
+		if (!is_valid_name(object->section_names, object->headers[header->shname_index].size, object->headers[i].name_offset)) {
+			printf("%s: Section %u has a name outside of the section name table\n", object->path, (u32) i);
+			return 0;
 		}
 	}
 
-	if (text_size != 0) {
-		out_buffer_size = text_size;
-		out_buffer = (u8*) malloc(out_buffer_size);
-		if (out_buffer == NULL) {
-			printf("Failed to allocate memory\n");
+	object->output_sections = (u32*) malloc(sizeof(u32) * header->shcount);
+	object->offsets = (u32*) calloc(header->shcount, sizeof(u32));
+	object->live = (u8*) malloc(header->shcount);
+	if (object->output_sections == NULL || object->offsets == NULL || object->live == NULL) {
+		printf("Failed to allocate memory\n");
+		return 0;
+	}
+
+	memset(object->live, 1, header->shcount);
+	usize symbol_names_size = 0;
+	for (usize i = 0; i < header->shcount; ++i) {
+		object->output_sections[i] = NO_OUTPUT;
+		if (object->headers[i].type == 0x02 && object->headers[i].link < header->shcount) {
+			object->symbols = (elf_symbol_t*) &object->buffer[object->headers[i].offset];
+			object->symbol_count = object->headers[i].size / sizeof(elf_symbol_t);
+			object->symbol_names = (char*) &object->buffer[object->headers[object->headers[i].link].offset];
+			symbol_names_size = object->headers[object->headers[i].link].size;
+		}
+	}
+
+	for (usize i = 1; i < object->symbol_count; ++i) {
+		if (object->symbols[i].section_index >= header->shcount) {
+			printf("%s: Symbol %u refers to an invalid section\n", object->path, (u32) i);
 			return 0;
 		}
 
-		memcpy(out_buffer, &elf_buffer[text_offset], text_size);
+		if (!is_valid_name(object->symbol_names, symbol_names_size, object->symbols[i].name_offset)) {
+			printf("%s: Symbol %u has a name outside of the symbol name table\n", object->path, (u32) i);
+			return 0;
+		}
 	}
 
-	// find all other sections and put them in buffer
-	for (usize i = 0; i < elf.header.shcount; ++i) {
-		elf_section_header_t* sh = (elf_section_header_t*) &elf_buffer[sh_offset + (i * elf.header.shentry_size)];
-		if (sh->name_offset == 0) {
-			continue;
+	return 1;
+}
+
+u32 find_output_section(linker_t* linker, const char* name) {
+	for (u32 i = 0; i < linker->section_count; ++i) {
+		if (strcmp(linker->sections[i].name, name) == 0) {
+			return i;
 		}
+	}
 
-		char* name = (char*) &elf_buffer[shstrtab_offset + sh->name_offset];
-		if (strcmp(name, ".text") == 0 || strcmp(name, ".shstrtab") == 0 || strcmp(name, ".symtab") == 0 || strcmp(name, ".strtab") == 0 || strncmp(name, ".rel", 4) == 0 || strncmp(name, ".debug", 6) == 0 || strncmp(name, ".note", 5) == 0 || strncmp(name, ".comment", 8) == 0) {
-			continue;
+	return NO_OUTPUT;
+}
+
+/* .text.name, .data.name and .bss.name let code and data be split per function for --gc-sections, they merge back into their parent */
+const char* output_section_name(const char* name) {
+	if (strcmp(name, ".text") == 0 || strncmp(name, ".text.", 6) == 0) {
+		return ".text";
+	} else if (strcmp(name, ".data") == 0 || strncmp(name, ".data.", 6) == 0) {
+		return ".data";
+	} else if (strcmp(name, ".bss") == 0 || strncmp(name, ".bss.", 5) == 0) {
+		return ".bss";
+	}
+
+	return name;
+}
+
+/* whether an input section ends up in the image, pass 0 only takes .text and pass 1 everything else */
+s32 is_image_section(object_t* object, usize index, s32 pass) {
+	elf_section_header_t* sh = &object->headers[index];
+	const char* name = &object->section_names[sh->name_offset];
+	if (sh->name_offset == 0 || sh->size == 0 || is_metadata_section(name)) {
+		return 0;
+	}
+
+	return (strcmp(output_section_name(name), ".text") == 0) == (pass == 0);
+}
+
+/* the section that holds the first byte of the image, which is where execution starts */
+s32 find_entry_section(linker_t* linker, usize* object_index, usize* section_index) {
+	for (s32 pass = 0; pass < 2; ++pass) {
+		for (usize i = 0; i < linker->object_count; ++i) {
+			for (usize j = 1; j < linker->objects[i].elf.header.shcount; ++j) {
+				if (is_image_section(&linker->objects[i], j, pass)) {
+					*object_index = i;
+					*section_index = j;
+					return 1;
+				}
+			}
 		}
+	}
 
-		if (sh->size == 0) {
-			continue;
+	return 0;
+}
+
+void mark_live(linker_t* linker, section_ref_t* stack, usize* count, usize object, usize section) {
+	if (section == 0 || linker->objects[object].live[section]) {
+		return;
+	}
+
+	linker->objects[object].live[section] = 1;
+	stack[(*count)++] = (section_ref_t){ .object = object, .section = section };
+}
+
+/*
+ * --gc-sections: marks every section reachable from the entry section and the --keep symbols through
+ * relocations, everything unmarked is left out of the layout. interrupt handlers and jump tables are reached
+ * through the ldi that installs or loads them, anything only found through computed addresses needs --keep
+ */
+s32 collect_garbage(linker_t* linker, char** keep, usize keep_count) {
+	usize total = 0;
+	for (usize i = 0; i < linker->object_count; ++i) {
+		memset(linker->objects[i].live, 0, linker->objects[i].elf.header.shcount);
+		total += linker->objects[i].elf.header.shcount;
+	}
+
+	section_ref_t* stack = (section_ref_t*) malloc(sizeof(section_ref_t) * (total + 1));
+	if (stack == NULL) {
+		printf("Failed to allocate memory\n");
+		return 0;
+	}
+
+	usize count = 0;
+	usize entry_object = 0;
+	usize entry_section = 0;
+	if (find_entry_section(linker, &entry_object, &entry_section)) {
+		mark_live(linker, stack, &count, entry_object, entry_section);
+	}
+
+	for (usize i = 0; i < keep_count; ++i) {
+		global_t* global = global_slot(&linker->globals, keep[i]);
+		if (global->name == NULL) {
+			printf("Symbol '%s' given to --keep is not defined\n", keep[i]);
+			free(stack);
+			return 0;
 		}
 
-		if (out_buffer == NULL) {
-			out_buffer_size = sh->size;
-			out_buffer = (u8*) malloc(out_buffer_size);
-			if (out_buffer == NULL) {
-				printf("Failed to allocate memory\n");
-				return 0;
+		mark_live(linker, stack, &count, global->object, linker->objects[global->object].symbols[global->symbol].section_index);
+	}
+
+	while (count != 0) {
+		section_ref_t ref = stack[--count];
+		object_t* object = &linker->objects[ref.object];
+		for (usize i = 1; i < object->elf.header.shcount; ++i) {
+			elf_section_header_t* sh = &object->headers[i];
+			if (sh->type != 0x09 || sh->info != ref.section) {
+				continue;
 			}
-		} else {
-			u8* p = (u8*) realloc(out_buffer, out_buffer_size + sh->size);
-			if (p == NULL) {
-				printf("Failed to allocate memory\n");
-				return 0;
+
+			elf_relocation_t* relocations = (elf_relocation_t*) &object->buffer[sh->offset];
+			for (usize j = 0; j < sh->size / sizeof(elf_relocation_t); ++j) {
+				usize symbol = relocations[j].info >> 8;
+				if (symbol == 0 || symbol >= object->symbol_count) {
+					continue;
+				}
+
+				elf_symbol_t* target = &object->symbols[symbol];
+				if (target->section_index != 0) {
+					mark_live(linker, stack, &count, ref.object, target->section_index);
+				} else {
+					global_t* global = global_slot(&linker->globals, &object->symbol_names[target->name_offset]);
+					mark_live(linker, stack, &count, global->object, linker->objects[global->object].symbols[global->symbol].section_index);
+				}
 			}
+		}
+	}
+
+	free(stack);
 
-			out_buffer = p;
-			memcpy(&out_buffer[out_buffer_size], &elf_buffer[sh->offset], sh->size);
-			out_buffer_size += sh->size;
+	u32 removed = 0;
+	u64 removed_bytes = 0;
+	for (usize i = 0; i < linker->object_count; ++i) {
+		object_t* object = &linker->objects[i];
+		for (usize j = 1; j < object->elf.header.shcount; ++j) {
+			if (!object->live[j] && (is_image_section(object, j, 0) || is_image_section(object, j, 1))) {
+				++removed;
+				removed_bytes += object->headers[j].size;
+			}
 		}
 	}
 
-	FILE* outfp = fopen(out_file, "wb");
-	if (outfp == NULL) {
-		printf("Failed to open file: %s\n", out_file);
-		free(out_buffer);
-		return 1;
+	printf("Removed %u unreferenced sections (%llu bytes)\n", removed, (unsigned long long) removed_bytes);
+	return 1;
+}
+
+/* where one relocation of a folding candidate points, compared instead of the relocated word itself */
+typedef struct {
+	usize object;
+	usize section;
+	u32 offset; /* of the relocated word in the referencing section */
+	u32 value; /* symbol offset within the target section */
+	u32 addend; /* stored word minus the symbol's provisional address */
+} fold_target_t;
+
+typedef struct {
+	usize object;
+	usize section;
+	usize first_target;
+	usize target_count;
+	u64 hash; /* of everything compared by fold_constants_equal */
+	u64 key;
+	u32 class;
+	u32 next_class;
+} fold_t;
+
+typedef struct {
+	fold_t* folds;
+	usize fold_count;
+	fold_target_t* targets;
+	usize target_count;
+	u32** candidate_of; /* per object and input section, index into folds or NO_OUTPUT */
+} icf_t;
+
+u64 hash_bytes(u64 hash, const void* data, usize size) {
+	const u8* bytes = (const u8*) data;
+	for (usize i = 0; i < size; ++i) {
+		hash = (hash ^ bytes[i]) * 0x100000001B3ull;
 	}
 
-	if (fwrite(out_buffer, 1, out_buffer_size, outfp) != out_buffer_size) {
-		printf("Failed to write file\n");
-		fclose(outfp);
-		free(out_buffer);
-		return 1;
+	return hash;
+}
+
+/* the class of a candidate target, other sections only ever match themselves */
+u64 fold_target_id(icf_t* icf, fold_target_t* target) {
+	u32 candidate = icf->candidate_of[target->object][target->section];
+	if (candidate != NO_OUTPUT) {
+		return icf->folds[candidate].class;
 	}
 
-	fclose(outfp);
-	free(out_buffer);
+	return (1ull << 63) | ((u64) target->object << 32) | target->section;
+}
 
-	if (ofile_malloced) {
-		free((void*) out_file);
+/* size, alignment, bytes outside the relocated words and the shape of every relocation */
+s32 fold_constants_equal(linker_t* linker, icf_t* icf, fold_t* a, fold_t* b) {
+	object_t* object_a = &linker->objects[a->object];
+	object_t* object_b = &linker->objects[b->object];
+	elf_section_header_t* sh_a = &object_a->headers[a->section];
+	elf_section_header_t* sh_b = &object_b->headers[b->section];
+	if (a->hash != b->hash || sh_a->size != sh_b->size || sh_a->address_align != sh_b->address_align || a->target_count != b->target_count) {
+		return 0;
 	}
 
-	free(elf_buffer);
-	return 0;
-}
\ No newline at end of file
+	const u8* bytes_a = &object_a->buffer[sh_a->offset];
+	const u8* bytes_b = &object_b->buffer[sh_b->offset];
+	u32 position = 0;
+	for (usize i = 0; i < a->target_count; ++i) {
+		fold_target_t* x = &icf->targets[a->first_target + i];
+		fold_target_t* y = &icf->targets[b->first_target + i];
+		if (x->offset != y->offset || x->value != y->value || x->addend != y->addend || x->offset < position) {
+			return 0;
+		}
+
+		if (memcmp(&bytes_a[position], &bytes_b[position], x->offset - position) != 0) {
+			return 0;
+		}
+		position = x->offset + 4;
+	}
+
+	return memcmp(&bytes_a[position], &bytes_b[position], sh_a->size - position) == 0;
+}
+
+s32 fold_equal(linker_t* linker, icf_t* icf, fold_t* a, fold_t* b) {
+	if (a->class != b->class || !fold_constants_equal(linker, icf, a, b)) {
+		return 0;
+	}
+
+	for (usize i = 0; i < a->target_count; ++i) {
+		if (fold_target_id(icf, &icf->targets[a->first_target + i]) != fold_target_id(icf, &icf->targets[b->first_target + i])) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+icf_t* compare_context;
+
+int compare_fold_keys(const void* a, const void* b) {
+	const fold_t* x = &compare_context->folds[*(const u32*) a];
+	const fold_t* y = &compare_context->folds[*(const u32*) b];
+	if (x->key != y->key) {
+		return (x->key < y->key) ? -1 : 1;
+	}
+
+	return (*(const u32*) a < *(const u32*) b) ? -1 : 1;
+}
+
+/* collects the .text sections that may fold, and where each of their relocations points */
+s32 collect_fold_candidates(linker_t* linker, icf_t* icf) {
+	usize entry_object = 0;
+	usize entry_section = 0;
+	s32 has_entry = find_entry_section(linker, &entry_object, &entry_section);
+
+	usize section_total = 0;
+	usize relocation_total = 0;
+	icf->candidate_of = (u32**) calloc(linker->object_count, sizeof(u32*));
+	if (icf->candidate_of == NULL) {
+		printf("Failed to allocate memory\n");
+		return 0;
+	}
+
+	for (usize i = 0; i < linker->object_count; ++i) {
+		object_t* object = &linker->objects[i];
+		section_total += object->elf.header.shcount;
+		icf->candidate_of[i] = (u32*) malloc(sizeof(u32) * object->elf.header.shcount);
+		if (icf->candidate_of[i] == NULL) {
+			printf("Failed to allocate memory\n");
+			return 0;
+		}
+
+		for (usize j = 0; j < object->elf.header.shcount; ++j) {
+			icf->candidate_of[i][j] = NO_OUTPUT;
+			if (object->headers[j].type == 0x09) {
+				relocation_total += object->headers[j].size / sizeof(elf_relocation_t);
+			}
+		}
+	}
+
+	icf->folds = (fold_t*) malloc(sizeof(fold_t) * (section_total + 1));
+	icf->targets = (fold_target_t*) malloc(sizeof(fold_target_t) * (relocation_total + 1));
+	if (icf->folds == NULL || icf->targets == NULL) {
+		printf("Failed to allocate memory\n");
+		return 0;
+	}
+
+	for (usize i = 0; i < linker->object_count; ++i) {
+		object_t* object = &linker->objects[i];
+		for (usize j = 1; j < object->elf.header.shcount; ++j) {
+			if (!object->live[j] || !is_image_section(object, j, 0) || (has_entry && i == entry_object && j == entry_section)) {
+				continue;
+			}
+
+			fold_t* fold = &icf->folds[icf->fold_count];
+			*fold = (fold_t){ .object = i, .section = j, .first_target = icf->target_count, .target_count = 0, .class = 0 };
+			for (usize k = 1; k < object->elf.header.shcount; ++k) {
+				elf_section_header_t* sh = &object->headers[k];
+				if (sh->type != 0x09 || sh->info != j) {
+					continue;
+				}
+
+				elf_relocation_t* relocations = (elf_relocation_t*) &object->buffer[sh->offset];
+				for (usize r = 0; r < sh->size / sizeof(elf_relocation_t); ++r) {
+					usize symbol_index = relocations[r].info >> 8;
+					if (symbol_index == 0 || symbol_index >= object->symbol_count || relocations[r].offset + 4 > object->headers[j].size) {
+						printf("%s: Invalid relocation %u in %s\n", object->path, (u32) r, &object->section_names[sh->name_offset]);
+						return 0;
+					}
+
+					elf_symbol_t* symbol = &object->symbols[symbol_index];
+					u8* word = &object->buffer[object->headers[j].offset + relocations[r].offset];
+					u32 provisional = 0;
+					fold_target_t target = { .object = i, .section = symbol->section_index, .offset = relocations[r].offset };
+					if (symbol->section_index == 0) {
+						global_t* global = global_slot(&linker->globals, &object->symbol_names[symbol->name_offset]);
+						symbol = &linker->objects[global->object].symbols[global->symbol];
+						target.object = global->object;
+						target.section = symbol->section_index;
+					} else {
+						provisional = object->headers[symbol->section_index].address + symbol->value;
+					}
+
+					target.value = symbol->value;
+					target.addend = (u32) (GET_U32(word, 0)) - provisional;
+					icf->targets[icf->target_count++] = target;
+					++fold->target_count;
+				}
+			}
+
+			u64 hash = 0xCBF29CE484222325ull;
+			elf_section_header_t* sh = &object->headers[j];
+			hash = hash_bytes(hash, &sh->size, sizeof(sh->size));
+			u32 position = 0;
+			for (usize k = 0; k < fold->target_count; ++k) {
+				fold_target_t* target = &icf->targets[fold->first_target + k];
+				if (target->offset >= position) {
+					hash = hash_bytes(hash, &object->buffer[sh->offset + position], target->offset - position);
+					position = target->offset + 4;
+				}
+				hash = hash_bytes(hash, &target->offset, sizeof(u32) * 3);
+			}
+
+			fold->hash = hash_bytes(hash, &object->buffer[sh->offset + position], sh->size - position);
+			icf->candidate_of[i][j] = (u32) icf->fold_count;
+			++icf->fold_count;
+		}
+	}
+
+	return 1;
+}
+
+/* splits the classes until nothing splits any more and returns how many there are */
+u32 refine_fold_classes(linker_t* linker, icf_t* icf, u32* order) {
+	u32 class_count = 1;
+	compare_context = icf;
+	while (1) {
+		for (usize i = 0; i < icf->fold_count; ++i) {
+			fold_t* fold = &icf->folds[i];
+			u64 key = hash_bytes(fold->hash, &fold->class, sizeof(u32));
+			for (usize j = 0; j < fold->target_count; ++j) {
+				u64 id = fold_target_id(icf, &icf->targets[fold->first_target + j]);
+				key = hash_bytes(key, &id, sizeof(u64));
+			}
+
+			fold->key = key;
+			order[i] = (u32) i;
+		}
+
+		qsort(order, icf->fold_count, sizeof(u32), compare_fold_keys);
+
+		/* members of one key group are matched against the group's earlier members, hashes only narrow down the comparisons */
+		u32 new_count = 0;
+		for (usize start = 0; start < icf->fold_count;) {
+			usize end = start + 1;
+			while (end < icf->fold_count && icf->folds[order[end]].key == icf->folds[order[start]].key) {
+				++end;
+			}
+
+			for (usize i = start; i < end; ++i) {
+				fold_t* fold = &icf->folds[order[i]];
+				fold->next_class = NO_OUTPUT;
+				for (usize j = start; j < i; ++j) {
+					fold_t* other = &icf->folds[order[j]];
+					if (fold_equal(linker, icf, fold, other)) {
+						fold->next_class = other->next_class;
+						break;
+					}
+				}
+
+				if (fold->next_class == NO_OUTPUT) {
+					fold->next_class = new_count++;
+				}
+			}
+
+			start = end;
+		}
+
+		for (usize i = 0; i < icf->fold_count; ++i) {
+			icf->folds[i].class = icf->folds[i].next_class;
+		}
+
+		/* classes only ever split, so an unchanged count means nothing did */
+		if (new_count == class_count) {
+			return class_count;
+		}
+		class_count = new_count;
+	}
+}
+
+/* keeps the first candidate of every class in command line order and points the others at it */
+s32 apply_folds(linker_t* linker, icf_t* icf, u32 class_count) {
+	section_ref_t* kept = (section_ref_t*) calloc(class_count + 1, sizeof(section_ref_t));
+	if (kept == NULL) {
+		printf("Failed to allocate memory\n");
+		return 0;
+	}
+
+	for (usize i = 0; i < linker->object_count; ++i) {
+		linker->objects[i].folded = (section_ref_t*) calloc(linker->objects[i].elf.header.shcount, sizeof(section_ref_t));
+		if (linker->objects[i].folded == NULL) {
+			printf("Failed to allocate memory\n");
+			free(kept);
+			return 0;
+		}
+	}
+
+	u32 folded = 0;
+	u64 saved = 0;
+	for (usize i = 0; i < icf->fold_count; ++i) {
+		fold_t* fold = &icf->folds[i];
+		if (kept[fold->class].section == 0) {
+			kept[fold->class] = (section_ref_t){ .object = fold->object, .section = fold->section };
+			continue;
+		}
+
+		object_t* object = &linker->objects[fold->object];
+		object->folded[fold->section] = kept[fold->class];
+		object->live[fold->section] = 0;
+		++folded;
+		saved += object->headers[fold->section].size;
+	}
+
+	printf("Identical code folding: folded %u of %u sections, saved %llu bytes\n", folded, (u32) icf->fold_count, (unsigned long long) saved);
+	free(kept);
+	return 1;
+}
+
+void free_icf(linker_t* linker, icf_t* icf) {
+	if (icf->candidate_of != NULL) {
+		for (usize i = 0; i < linker->object_count; ++i) {
+			free(icf->candidate_of[i]);
+		}
+	}
+
+	free(icf->candidate_of);
+	free(icf->folds);
+	free(icf->targets);
+}
+
+/*
+ * --icf=all: folds .text sections that are identical once relocated. every candidate starts in one class and
+ * classes are split by their bytes, relocation shapes and the classes of their relocation targets, so
+ * identical mutually recursive functions fold too. references to a folded section go to the one kept
+ */
+s32 fold_identical_code(linker_t* linker) {
+	icf_t icf = { 0 };
+	if (!collect_fold_candidates(linker, &icf)) {
+		free_icf(linker, &icf);
+		return 0;
+	}
+
+	u32* order = (u32*) malloc(sizeof(u32) * (icf.fold_count + 1));
+	if (order == NULL) {
+		printf("Failed to allocate memory\n");
+		free_icf(linker, &icf);
+		return 0;
+	}
+
+	u32 class_count = refine_fold_classes(linker, &icf, order);
+	s32 result = apply_folds(linker, &icf, class_count);
+	free(order);
+	free_icf(linker, &icf);
+	return result;
+}
+
+/* entry section first, then hot sections by descending count, then everything else in command line order */
+int compare_contributions(const void* a, const void* b) {
+	const contribution_t* x = (const contribution_t*) a;
+	const contribution_t* y = (const contribution_t*) b;
+	if (x->output != y->output) {
+		return (x->output < y->output) ? -1 : 1;
+	}
+
+	if ((x->order == 0) != (y->order == 0)) {
+		return (x->order == 0) ? -1 : 1;
+	}
+
+	if (x->heat != y->heat) {
+		return (x->heat > y->heat) ? -1 : 1;
+	}
+
+	return (x->order < y->order) ? -1 : (x->order > y->order);
+}
+
+/*
+ * same-named sections are merged in command line order, .text first and the rest in the order they are first seen.
+ * with --layout-profile the sections inside each output section are reordered by their counts, may run again
+ * after the profile was mapped onto the first layout
+ */
+s32 layout_sections(linker_t* linker, u32 base_address) {
+	usize capacity = 1;
+	for (usize i = 0; i < linker->object_count; ++i) {
+		capacity += linker->objects[i].elf.header.shcount;
+	}
+
+	free(linker->sections);
+	free(linker->contributions);
+	linker->section_count = 0;
+	linker->contribution_count = 0;
+	linker->sections = (output_section_t*) calloc(capacity, sizeof(output_section_t));
+	linker->contributions = (contribution_t*) malloc(capacity * sizeof(contribution_t));
+	if (linker->sections == NULL || linker->contributions == NULL) {
+		printf("Failed to allocate memory\n");
+		return 0;
+	}
+
+	for (usize i = 0; i < linker->object_count; ++i) {
+		for (usize j = 0; j < linker->objects[i].elf.header.shcount; ++j) {
+			linker->objects[i].output_sections[j] = NO_OUTPUT;
+		}
+	}
+
+	for (s32 pass = 0; pass < 2; ++pass) {
+		for (usize i = 0; i < linker->object_count; ++i) {
+			object_t* object = &linker->objects[i];
+			for (usize j = 1; j < object->elf.header.shcount; ++j) {
+				if (!object->live[j] || !is_image_section(object, j, pass)) {
+					continue;
+				}
+
+				const char* name = output_section_name(&object->section_names[object->headers[j].name_offset]);
+				u32 output = find_output_section(linker, name);
+				if (output == NO_OUTPUT) {
+					output = (u32) linker->section_count++;
+					linker->sections[output].name = name;
+				}
+
+				u64 heat = (object->heat != NULL) ? object->heat[j] : 0;
+				linker->contributions[linker->contribution_count] = (contribution_t){ .object = i, .section = j, .output = output, .order = (u32) linker->contribution_count, .heat = heat };
+				object->output_sections[j] = output;
+				++linker->contribution_count;
+			}
+		}
+	}
+
+	qsort(linker->contributions, linker->contribution_count, sizeof(contribution_t), compare_contributions);
+	for (usize i = 0; i < linker->contribution_count; ++i) {
+		object_t* object = &linker->objects[linker->contributions[i].object];
+		usize j = linker->contributions[i].section;
+		elf_section_header_t* sh = &object->headers[j];
+		output_section_t* section = &linker->sections[linker->contributions[i].output];
+		if (sh->address_align > 1) {
+			if ((sh->address_align & (sh->address_align - 1)) != 0) {
+				printf("%s: Section %s has an alignment of %u which is not a power of two\n", object->path, &object->section_names[sh->name_offset], sh->address_align);
+				return 0;
+			}
+
+			section->size = (section->size + sh->address_align - 1) & ~(sh->address_align - 1);
+			section->align = (sh->address_align > section->align) ? sh->address_align : section->align;
+		}
+
+		object->offsets[j] = section->size;
+		section->size += sh->size;
+	}
+
+	for (usize i = 0; i < linker->start_count; ++i) {
+		u32 output = find_output_section(linker, linker->starts[i].name);
+		if (output != NO_OUTPUT) {
+			linker->sections[output].has_start = 1;
+			linker->sections[output].start = linker->starts[i].address;
+			linker->starts[i].used = 1;
+		}
+	}
+
+	/* the first section has to start exactly at the base since that is where execution begins */
+	if (linker->section_count != 0 && !linker->sections[0].has_start && linker->sections[0].align > 1 && (base_address & (linker->sections[0].align - 1)) != 0) {
+		printf("Base address 0x%08x is not aligned to the %u bytes %s requires\n", base_address, linker->sections[0].align, linker->sections[0].name);
+		return 0;
+	}
+
+	/* only addresses are assigned here, the bytes stay in the inputs until write_image gathers them */
+	u64 address = base_address;
+	for (usize i = 0; i < linker->section_count; ++i) {
+		output_section_t* section = &linker->sections[i];
+		u32 align = (section->align > 1) ? section->align : 1;
+		if (section->has_start) {
+			if (section->start < address) {
+				printf("Section %s placed at 0x%08x overlaps the image below it, which ends at 0x%08llx\n", section->name, section->start, (unsigned long long) address);
+				return 0;
+			}
+
+			if ((section->start & (align - 1)) != 0) {
+				printf("Section %s placed at 0x%08x is not aligned to the %u bytes it requires\n", section->name, section->start, align);
+				return 0;
+			}
+
+			address = section->start;
+		}
+
+		address = (address + align - 1) & ~((u64) align - 1);
+		linker->sections[i].address = (u32) address;
+		address += linker->sections[i].size;
+		if (address > 0x100000000ull) {
+			printf("Image does not fit in the address space above base address 0x%08x\n", base_address);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* defined local labels by name, symbol 0 (the null symbol) marks a name more than one object defines */
+s32 collect_locals(linker_t* linker, global_table_t* locals) {
+	usize count = 0;
+	for (usize i = 0; i < linker->object_count; ++i) {
+		count += linker->objects[i].symbol_count;
+	}
+
+	locals->capacity = 16;
+	while (locals->capacity < count * 2) {
+		locals->capacity *= 2;
+	}
+
+	locals->count = 0;
+	locals->slots = (global_t*) calloc(locals->capacity, sizeof(global_t));
+	if (locals->slots == NULL) {
+		printf("Failed to allocate memory\n");
+		return 0;
+	}
+
+	for (usize i = 0; i < linker->object_count; ++i) {
+		object_t* object = &linker->objects[i];
+		for (usize j = 1; j < object->symbol_count; ++j) {
+			elf_symbol_t* symbol = &object->symbols[j];
+			if ((symbol->info >> 4) == 1 || symbol->section_index == 0) {
+				continue;
+			}
+
+			const char* name = &object->symbol_names[symbol->name_offset];
+			global_t* slot = global_slot(locals, name);
+			if (slot->name != NULL) {
+				slot->symbol = 0;
+				continue;
+			}
+
+			*slot = (global_t){ .name = name, .object = i, .symbol = j };
+			++locals->count;
+		}
+	}
+
+	return 1;
+}
+
+/*
+ * --layout-profile file, one '<symbol> <count>' or '0x<address> <count>' pair per line and '#' comments.
+ * addresses are in the image linked without the profile at the same --base, so counts recorded by running
+ * that image can be fed straight back. counts are summed per input section, names and addresses that no
+ * longer match anything are skipped so a stale profile still links
+ */
+s32 load_profile(linker_t* linker, const char* path) {
+	FILE* file = fopen(path, "r");
+	if (file == NULL) {
+		printf("Failed to open file: %s\n", path);
+		return 0;
+	}
+
+	for (usize i = 0; i < linker->object_count; ++i) {
+		linker->objects[i].heat = (u64*) calloc(linker->objects[i].elf.header.shcount, sizeof(u64));
+		if (linker->objects[i].heat == NULL) {
+			printf("Failed to allocate memory\n");
+			fclose(file);
+			return 0;
+		}
+	}
+
+	/* built once, a profile of a large link has as many lines as the link has symbols */
+	global_table_t locals;
+	if (!collect_locals(linker, &locals)) {
+		fclose(file);
+		return 0;
+	}
+
+	char line[512];
+	u32 line_number = 0;
+	u32 unmatched = 0;
+	while (fgets(line, sizeof(line), file) != NULL) {
+		++line_number;
+		char key[256];
+		unsigned long long count = 0;
+		char* start = line;
+		while (*start == ' ' || *start == '\t') {
+			++start;
+		}
+
+		if (*start == '#' || *start == '\n' || *start == '\r' || *start == '\0') {
+			continue;
+		}
+
+		if (sscanf(start, "%255s %llu", key, &count) != 2) {
+			printf("%s:%u: Expected '<symbol or 0xaddress> <count>'\n", path, line_number);
+			free(locals.slots);
+			fclose(file);
+			return 0;
+		}
+
+		usize object_index = 0;
+		usize section_index = 0;
+		s32 found = 0;
+		if (key[0] == '0' && key[1] == 'x') {
+			/* contributions are sorted by address after a layout, so the one containing it is found by bisection */
+			char* end = NULL;
+			unsigned long value = strtoul(&key[2], &end, 16);
+			usize digits = strspn(&key[2], "0123456789abcdefABCDEF");
+			if (digits == 0 || digits > 8 || *end != '\0' || end != &key[2 + digits]) {
+				printf("%s:%u: Invalid address '%s'\n", path, line_number, key);
+				free(locals.slots);
+				fclose(file);
+				return 0;
+			}
+
+			u32 address = (u32) value;
+			usize low = 0;
+			usize high = linker->contribution_count;
+			while (low < high) {
+				usize middle = low + (high - low) / 2;
+				contribution_t* contribution = &linker->contributions[middle];
+				object_t* object = &linker->objects[contribution->object];
+				u32 start_address = linker->sections[contribution->output].address + object->offsets[contribution->section];
+				if (address < start_address) {
+					high = middle;
+				} else if (address - start_address >= object->headers[contribution->section].size) {
+					low = middle + 1;
+				} else {
+					object_index = contribution->object;
+					section_index = contribution->section;
+					found = 1;
+					break;
+				}
+			}
+		} else {
+			global_t* global = global_slot(&linker->globals, key);
+			if (global->name != NULL) {
+				object_index = global->object;
+				section_index = linker->objects[global->object].symbols[global->symbol].section_index;
+				found = 1;
+			} else {
+				/* local labels are only unambiguous when a single object defines the name */
+				global_t* local = global_slot(&locals, key);
+				if (local->name != NULL && local->symbol != 0) {
+					object_index = local->object;
+					section_index = linker->objects[local->object].symbols[local->symbol].section_index;
+					found = 1;
+				}
+			}
+		}
+
+		if (!found) {
+			++unmatched;
+			continue;
+		}
+
+		object_t* object = &linker->objects[object_index];
+		if (object->folded != NULL && object->folded[section_index].section != 0) {
+			section_ref_t kept = object->folded[section_index];
+			object_index = kept.object;
+			section_index = kept.section;
+		}
+
+		linker->objects[object_index].heat[section_index] += count;
+	}
+
+	free(locals.slots);
+	fclose(file);
+
+	u32 hot = 0;
+	for (usize i = 0; i < linker->contribution_count; ++i) {
+		hot += linker->objects[linker->contributions[i].object].heat[linker->contributions[i].section] != 0;
+	}
+
+	printf("Layout profile: %u of %u sections are hot", hot, (u32) linker->contribution_count);
+	if (unmatched != 0) {
+		printf(", %u entries did not match anything", unmatched);
+	}
+	printf("\n");
+	return 1;
+}
+
+s32 collect_globals(linker_t* linker) {
+	usize count = 0;
+	for (usize i = 0; i < linker->object_count; ++i) {
+		count += linker->objects[i].symbol_count;
+	}
+
+	linker->globals.capacity = 16;
+	while (linker->globals.capacity < count * 2) {
+		linker->globals.capacity *= 2;
+	}
+
+	linker->globals.slots = (global_t*) calloc(linker->globals.capacity, sizeof(global_t));
+	if (linker->globals.slots == NULL) {
+		printf("Failed to allocate memory\n");
+		return 0;
+	}
+
+	s32 result = 1;
+	for (usize i = 0; i < linker->object_count; ++i) {
+		object_t* object = &linker->objects[i];
+		for (usize j = 1; j < object->symbol_count; ++j) {
+			elf_symbol_t* symbol = &object->symbols[j];
+			if ((symbol->info >> 4) != 1 || symbol->section_index == 0) {
+				continue;
+			}
+
+			const char* name = &object->symbol_names[symbol->name_offset];
+			global_t* slot = global_slot(&linker->globals, name);
+			if (slot->name != NULL) {
+				printf("Duplicate symbol '%s' defined in %s and %s\n", name, linker->objects[slot->object].path, object->path);
+				result = 0;
+				continue;
+			}
+
+			*slot = (global_t){ .name = name, .object = i, .symbol = j };
+			++linker->globals.count;
+		}
+	}
+
+	for (usize i = 0; i < linker->object_count; ++i) {
+		object_t* object = &linker->objects[i];
+		for (usize j = 1; j < object->symbol_count; ++j) {
+			elf_symbol_t* symbol = &object->symbols[j];
+			const char* name = &object->symbol_names[symbol->name_offset];
+			if (symbol->section_index == 0 && global_slot(&linker->globals, name)->name == NULL) {
+				printf("Undefined symbol '%s' referenced in %s\n", name, object->path);
+				result = 0;
+			}
+		}
+	}
+
+	return result;
+}
+
+/* final and assembled address of a symbol, undefined ones are looked up by name and were assembled as 0 */
+s32 resolve_symbol(linker_t* linker, object_t* object, usize index, u32* address, u32* provisional) {
+	elf_symbol_t* symbol = &object->symbols[index];
+	*provisional = 0;
+	if (symbol->section_index == 0) {
+		global_t* global = global_slot(&linker->globals, &object->symbol_names[symbol->name_offset]);
+		object = &linker->objects[global->object];
+		symbol = &object->symbols[global->symbol];
+	} else {
+		*provisional = object->headers[symbol->section_index].address + symbol->value;
+	}
+
+	/* a folded section is byte for byte the one kept in its place, so the symbol keeps its offset */
+	object_t* owner = object;
+	usize section_index = symbol->section_index;
+	if (object->folded != NULL && object->folded[section_index].section != 0) {
+		owner = &linker->objects[object->folded[section_index].object];
+		section_index = object->folded[section_index].section;
+	}
+
+	u32 output = owner->output_sections[section_index];
+	if (output == NO_OUTPUT) {
+		printf("%s: Symbol '%s' is in a section that is not part of the image\n", object->path, &object->symbol_names[symbol->name_offset]);
+		return 0;
+	}
+
+	*address = linker->sections[output].address + owner->offsets[section_index] + symbol->value;
+	return 1;
+}
+
+/* applies the object's relocations to its own mapping, so objects never touch the same bytes */
+s32 relocate_object(linker_t* linker, usize index) {
+	object_t* object = &linker->objects[index];
+	for (usize i = 1; i < object->elf.header.shcount; ++i) {
+		elf_section_header_t* sh = &object->headers[i];
+		if (sh->type != 0x09 || sh->info >= object->elf.header.shcount || object->output_sections[sh->info] == NO_OUTPUT) {
+			continue;
+		}
+
+		u8* target = &object->buffer[object->headers[sh->info].offset];
+		elf_relocation_t* relocations = (elf_relocation_t*) &object->buffer[sh->offset];
+		for (usize j = 0; j < sh->size / sizeof(elf_relocation_t); ++j) {
+			u32 type = relocations[j].info & 0xFF;
+			u32 symbol = relocations[j].info >> 8;
+			if (type != R_KR32_32 || symbol == 0 || symbol >= object->symbol_count || relocations[j].offset + 4 > object->headers[sh->info].size) {
+				printf("%s: Invalid relocation %u in %s\n", object->path, (u32) j, &object->section_names[sh->name_offset]);
+				return 0;
+			}
+
+			u32 address = 0;
+			u32 provisional = 0;
+			if (!resolve_symbol(linker, object, symbol, &address, &provisional)) {
+				return 0;
+			}
+
+			u8* p = &target[relocations[j].offset];
+			u32 stored = GET_U32(p, 0);
+			u32 value = address + (stored - provisional);
+			p[0] = (u8) value;
+			p[1] = (u8) (value >> 8);
+			p[2] = (u8) (value >> 16);
+			p[3] = (u8) (value >> 24);
+		}
+	}
+
+	return 1;
+}
+
+#ifdef _WIN32
+typedef struct {
+	void* iov_base;
+	usize iov_len;
+} chunk_t;
+#else
+typedef struct iovec chunk_t;
+#endif
+
+typedef struct {
+	chunk_t* chunks;
+	usize count;
+	usize capacity;
+} chunk_list_t;
+
+u8 zeros[4096];
+
+s32 add_chunk(chunk_list_t* list, const u8* data, usize size) {
+	if (list->count == list->capacity) {
+		usize capacity = (list->capacity == 0) ? 64 : list->capacity * 2;
+		chunk_t* chunks = (chunk_t*) realloc(list->chunks, capacity * sizeof(chunk_t));
+		if (chunks == NULL) {
+			printf("Failed to allocate memory\n");
+			return 0;
+		}
+
+		list->chunks = chunks;
+		list->capacity = capacity;
+	}
+
+	list->chunks[list->count].iov_base = (void*) data;
+	list->chunks[list->count].iov_len = size;
+	++list->count;
+	return 1;
+}
+
+s32 add_padding(chunk_list_t* list, u64 size) {
+	while (size != 0) {
+		usize count = (size < sizeof(zeros)) ? (usize) size : sizeof(zeros);
+		if (!add_chunk(list, zeros, count)) {
+			return 0;
+		}
+		size -= count;
+	}
+
+	return 1;
+}
+
+/* .bss made only of zeros, which a sparse image leaves to the loader when it ends a segment */
+s32 is_zero_fill(linker_t* linker, u32 output) {
+	for (usize i = 0; i < linker->contribution_count; ++i) {
+		if (linker->contributions[i].output != output) {
+			continue;
+		}
+
+		object_t* object = &linker->objects[linker->contributions[i].object];
+		elf_section_header_t* sh = &object->headers[linker->contributions[i].section];
+		if (sh->type != 0x08) {
+			return 0;
+		}
+
+		for (u32 j = 0; j < sh->size; ++j) {
+			if (object->buffer[sh->offset + j] != 0) {
+				return 0;
+			}
+		}
+	}
+
+	return 1;
+}
+
+/*
+ * splits the laid out sections into segments wherever the gap between two is larger than SPARSE_MAX_GAP and
+ * returns the header and segment table to write in front of the payloads
+ */
+u8* build_sparse_header(linker_t* linker, u32 entry, sparse_segment_t** out_segments, u32* out_count, usize* out_size) {
+	sparse_segment_t* segments = (sparse_segment_t*) calloc(linker->section_count + 1, sizeof(sparse_segment_t));
+	if (segments == NULL) {
+		printf("Failed to allocate memory\n");
+		return NULL;
+	}
+
+	u32 count = 0;
+	u64 end = 0;
+	u64 file_end = 0;
+	for (u32 i = 0; i < linker->section_count; ++i) {
+		output_section_t* section = &linker->sections[i];
+		if (count == 0 || section->address - end > SPARSE_MAX_GAP) {
+			if (count == 0xFFFF) {
+				printf("Image needs more than 65535 segments\n");
+				free(segments);
+				return NULL;
+			}
+
+			segments[count++].address = section->address;
+			file_end = section->address;
+		}
+
+		end = (u64) section->address + section->size;
+		if (!is_zero_fill(linker, i)) {
+			file_end = end;
+		}
+
+		sparse_segment_t* segment = &segments[count - 1];
+		segment->file_size = (u32) (file_end - segment->address);
+		segment->memory_size = (u32) (end - segment->address);
+	}
+
+	usize size = sizeof(sparse_header_t) + count * sizeof(sparse_segment_t);
+	u32 offset = (u32) size;
+	for (u32 i = 0; i < count; ++i) {
+		segments[i].offset = offset;
+		offset += segments[i].file_size;
+	}
+
+	u8* header_bytes = (u8*) malloc(size);
+	if (header_bytes == NULL) {
+		printf("Failed to allocate memory\n");
+		free(segments);
+		return NULL;
+	}
+
+	sparse_header_t header = { .version = SPARSE_VERSION, .segment_count = (u16) count, .entry = entry, .reserved = 0 };
+	memcpy(header.magic, SPARSE_MAGIC, 4);
+	memcpy(header_bytes, &header, sizeof(sparse_header_t));
+	memcpy(&header_bytes[sizeof(sparse_header_t)], segments, count * sizeof(sparse_segment_t));
+
+	*out_segments = segments;
+	*out_count = count;
+	*out_size = size;
+	return header_bytes;
+}
+
+/*
+ * gathers the image straight from the relocated inputs: one chunk per contribution in layout order and
+ * chunks of a shared zero page for alignment gaps, written with writev so nothing is copied into an output buffer.
+ * a flat image covers everything from the base, a sparse one only the bytes of its segments
+ */
+s32 write_image(linker_t* linker, const char* path, u32 base_address, s32 sparse) {
+	chunk_list_t list = { 0 };
+	sparse_segment_t* segments = NULL;
+	u32 segment_count = 0;
+	u8* header = NULL;
+	if (sparse) {
+		usize header_size = 0;
+		u32 entry = (linker->section_count != 0) ? linker->sections[0].address : base_address;
+		header = build_sparse_header(linker, entry, &segments, &segment_count, &header_size);
+		if (header == NULL || !add_chunk(&list, header, header_size)) {
+			free(header);
+			free(segments);
+			return 0;
+		}
+	}
+
+	u32 segment = 0;
+	u64 position = sparse && segment_count != 0 ? segments[0].address : base_address;
+	for (usize i = 0; i < linker->contribution_count; ++i) {
+		object_t* object = &linker->objects[linker->contributions[i].object];
+		usize k = linker->contributions[i].section;
+		u64 address = (u64) linker->sections[linker->contributions[i].output].address + object->offsets[k];
+		if (sparse) {
+			while (address >= (u64) segments[segment].address + segments[segment].memory_size) {
+				++segment;
+				position = segments[segment].address;
+			}
+
+			if (address >= (u64) segments[segment].address + segments[segment].file_size) {
+				continue;
+			}
+		}
+
+		if (!add_padding(&list, address - position) || !add_chunk(&list, &object->buffer[object->headers[k].offset], object->headers[k].size)) {
+			free(list.chunks);
+			free(header);
+			free(segments);
+			return 0;
+		}
+		position = address + object->headers[k].size;
+	}
+
+	free(segments);
+
+#ifdef _WIN32
+	FILE* outfp = fopen(path, "wb");
+	if (outfp == NULL) {
+		printf("Failed to open file: %s\n", path);
+		free(list.chunks);
+		free(header);
+		return 0;
+	}
+
+	for (usize i = 0; i < list.count; ++i) {
+		if (fwrite(list.chunks[i].iov_base, 1, list.chunks[i].iov_len, outfp) != list.chunks[i].iov_len) {
+			printf("Failed to write file\n");
+			fclose(outfp);
+			free(list.chunks);
+			free(header);
+			return 0;
+		}
+	}
+
+	fclose(outfp);
+#else
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		printf("Failed to open file: %s\n", path);
+		free(list.chunks);
+		free(header);
+		return 0;
+	}
+
+	/* writev takes at most IOV_MAX chunks and may stop early, partially written chunks are resumed in place */
+	usize next = 0;
+	while (next < list.count) {
+		usize count = list.count - next;
+		if (count > IOV_MAX) {
+			count = IOV_MAX;
+		}
+
+		ssize_t written = writev(fd, &list.chunks[next], (int) count);
+		if (written < 0) {
+			printf("Failed to write file\n");
+			close(fd);
+			free(list.chunks);
+			free(header);
+			return 0;
+		}
+
+		while (next < list.count && (usize) written >= list.chunks[next].iov_len) {
+			written -= list.chunks[next].iov_len;
+			++next;
+		}
+
+		if (written != 0) {
+			list.chunks[next].iov_base = (u8*) list.chunks[next].iov_base + written;
+			list.chunks[next].iov_len -= written;
+		}
+	}
+
+	close(fd);
+#endif
+	free(list.chunks);
+	free(header);
+	return 1;
+}
+
+int main(int argc, char** argv) {
+	s32 base_set = 0;
+	u32 base_address = 0;
+	u32 thread_count = 1;
+	s32 gc_sections = 0;
+	s32 icf = 0;
+	s32 sparse = 0;
+	const char* profile_file = NULL;
+	char** keep = (char**) calloc(argc + 1, sizeof(char*));
+	usize keep_count = 0;
+
+	linker_t linker = { 0 };
+	linker.objects = (object_t*) calloc(argc + 1, sizeof(object_t));
+	linker.starts = (section_start_t*) calloc(argc + 1, sizeof(section_start_t));
+	if (linker.objects == NULL || keep == NULL || linker.starts == NULL) {
+		printf("Failed to allocate memory\n");
+		return 1;
+	}
+
+	const char* out_file = NULL;
+
+	s32 ofile_malloced = 0;
+
+	#ifdef DEBUG_FIXED_FILES
+	linker.objects[linker.object_count++].path = "../../../../assembler/test.elf";
+	out_file = "../../../test.bin";
+	#else
+	if (argc < 2) {
+		printf("Usage: %s <object file>... [options]\n", argv[0]);
+		printf("Flags:\n  [-o], [/Fo]\n    <output file>  Output file\n  [--base], [/B]\n    <32-bit address> Address the image is linked to run at, load it there with k32-emu --load (default 0)\n");
+		printf("  [-j]\n    <count>  Load and relocate up to this many objects in parallel (default 1)\n");
+		printf("  [--gc-sections]\n    Leave out sections nothing reachable from the entry point refers to\n");
+		printf("  [--keep]\n    <symbol>  Keep the section defining this symbol with --gc-sections, may be repeated\n");
+		printf("  [--icf=all], [--icf=none]\n    Fold .text sections that are identical after relocation into one\n");
+		printf("  [--section-start]\n    <name>=<address>  Place an output section at a fixed address, later sections follow it\n");
+		printf("  [--sparse]\n    Write a segment table and only the bytes of each segment instead of a flat image\n");
+		printf("  [--layout-profile]\n    <file>  Place sections with the highest counts first, lines of '<symbol or 0xaddress> <count>'\n");
+		return 1;
+	}
+	#endif
+
+	for (usize i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "/Fo") == 0) {
+			if (i + 1 >= argc) {
+				printf("Expected output file after -o\n");
+				return 1;
+			}
+
+			out_file = argv[i + 1];
+			++i;
+		} else if (strcmp(argv[i], "--base") == 0 || strcmp(argv[i], "/B") == 0) {
+			if (i + 1 >= argc) {
+				printf("Expected base address after --base\n");
+				return 1;
+			}
+
+			char* base_str = argv[i + 1];
+			usize len = strlen(base_str);
+
+			u32(*char_to_u32)(char) = decchar_to_u32;
+			u32 radix = 10;
+			u32 start = 0;
+			if (len > 2 && base_str[0] == '0' && base_str[1] == 'x') {
+				char_to_u32 = hexchar_to_u32;
+				radix = 16;
+				start = 2;
+			}
+
+			u64 value = 0;
+			for (usize i = start; i < len; ++i) {
+				value = (value * radix) + char_to_u32(base_str[i]);
+			}
+
+			if (value > 0xFFFFFFFF) {
+				printf("Warning: Base address is larger than 32-bits, truncating value\n");
+			}
+			base_address = (u32) value;
+			base_set = 1;
+			++i;
+		} else if (strcmp(argv[i], "--gc-sections") == 0) {
+			gc_sections = 1;
+		} else if (strcmp(argv[i], "--sparse") == 0) {
+			sparse = 1;
+		} else if (strcmp(argv[i], "--section-start") == 0) {
+			char* separator = (i + 1 < argc) ? strchr(argv[i + 1], '=') : NULL;
+			char* end = NULL;
+			unsigned long long value = (separator != NULL) ? strtoull(separator + 1, &end, 0) : 0;
+			if (separator == NULL || separator == argv[i + 1] || end == separator + 1 || *end != '\0' || value > 0xFFFFFFFF) {
+				printf("Expected <section>=<address> after --section-start\n");
+				return 1;
+			}
+
+			*separator = '\0';
+			linker.starts[linker.start_count++] = (section_start_t){ .name = argv[i + 1], .address = (u32) value, .used = 0 };
+			++i;
+		} else if (strcmp(argv[i], "--icf=all") == 0) {
+			icf = 1;
+		} else if (strcmp(argv[i], "--icf=none") == 0) {
+			icf = 0;
+		} else if (strncmp(argv[i], "--icf=", 6) == 0) {
+			printf("Unknown --icf mode '%s', expected all or none\n", &argv[i][6]);
+			return 1;
+		} else if (strcmp(argv[i], "--layout-profile") == 0) {
+			if (i + 1 >= argc) {
+				printf("Expected profile file after --layout-profile\n");
+				return 1;
+			}
+
+			profile_file = argv[i + 1];
+			++i;
+		} else if (strcmp(argv[i], "--keep") == 0) {
+			if (i + 1 >= argc) {
+				printf("Expected symbol name after --keep\n");
+				return 1;
+			}
+
+			keep[keep_count++] = argv[i + 1];
+			++i;
+		} else if (strcmp(argv[i], "-j") == 0) {
+			if (i + 1 >= argc) {
+				printf("Expected job count after -j\n");
+				return 1;
+			}
+
+			thread_count = (u32) strtoul(argv[i + 1], NULL, 10);
+			if (thread_count == 0) {
+				printf("Job count must be at least 1\n");
+				return 1;
+			}
+			++i;
+		} else {
+			linker.objects[linker.object_count++].path = argv[i];
+		}
+	}
+
+	if (!base_set) {
+		printf("Warning: Base address not set, defaulting to 0x00000000\n");
+		base_address = 0;
+	}
+
+	if (linker.object_count == 0) {
+		printf("No source file specified\n");
+		return 1;
+	}
+
+	if (out_file == NULL) {
+		const char* elf_file = linker.objects[0].path;
+		usize len = strlen(elf_file);
+		usize base_len = len;
+		char* ext = strrchr(elf_file, '.');
+		if (ext == NULL) {
+			len += 4;
+		} else {
+			base_len -= strlen(ext);
+			len = base_len + 4;
+		}
+
+		out_file = (char*) malloc(len + 1);
+		if (out_file == NULL) {
+			printf("Failed to allocate memory\n");
+			return 1;
+		}
+
+		strncpy((char*) out_file, elf_file, base_len);
+		strncpy((char*) &out_file[base_len], ".bin", 4);
+		((char*) out_file)[len] = '\0';
+		ofile_malloced = 1;
+	}
+
+	if (!run_jobs(&linker, load_object, linker.object_count, thread_count)) {
+		return 1;
+	}
+
+	if (!collect_globals(&linker)) {
+		return 1;
+	}
+
+	if (gc_sections && !collect_garbage(&linker, keep, keep_count)) {
+		return 1;
+	}
+
+	if (icf && !fold_identical_code(&linker)) {
+		return 1;
+	}
+
+	if (!layout_sections(&linker, base_address)) {
+		return 1;
+	}
+
+	if (profile_file != NULL && (!load_profile(&linker, profile_file) || !layout_sections(&linker, base_address))) {
+		return 1;
+	}
+
+	if (!run_jobs(&linker, relocate_object, linker.object_count, thread_count)) {
+		return 1;
+	}
+
+	for (usize i = 0; i < linker.start_count; ++i) {
+		if (!linker.starts[i].used) {
+			printf("Warning: Section %s given to --section-start is not in the image\n", linker.starts[i].name);
+		}
+	}
+
+	/* a flat image is loaded at the base and starts executing there */
+	if (!sparse && linker.section_count != 0 && linker.sections[0].address != base_address) {
+		printf("Section %s starts at 0x%08x instead of the base address 0x%08x, which only a --sparse image can express\n", linker.sections[0].name, linker.sections[0].address, base_address);
+		return 1;
+	}
+
+	if (!write_image(&linker, out_file, base_address, sparse)) {
+		return 1;
+	}
+
+	if (ofile_malloced) {
+		free((void*) out_file);
+	}
+
+	for (usize i = 0; i < linker.object_count; ++i) {
+		close_object(&linker.objects[i]);
+	}
+
+	free(linker.sections);
+	free(linker.contributions);
+	free(linker.starts);
+	free(linker.globals.slots);
+	free(linker.objects);
+	free(keep);
+	return 0;
+}
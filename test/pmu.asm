@@ -0,0 +1,19 @@
+// arms counter 0 on retired instructions in the middle of a run and reports what it counted through tracepoint 0x26
+// the three ldi after the sys 0x07 and the ldi before the sys 0x08 retire while it counts, so the payload must be 4
+.text
+start:
+    ldi sys0, 0
+    ldi sys1, 1
+    ldi sys2, 0
+    sys 0x07
+
+    ldi r1, 1
+    ldi r2, 2
+    ldi r3, 3
+
+    ldi sys0, 0
+    sys 0x08
+    ldr sys1, sys0
+    ldi sys0, 0x26
+    sys 0x0B
+    hlt
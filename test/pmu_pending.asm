@@ -0,0 +1,27 @@
+// a counter overflows before the guest sets an interrupt handler, interrupt 0x05 has to wait for the handler instead of being dropped
+// the handler reports through tracepoint 0x27
+.text
+start:
+    ldi sp, 0x1000
+    ldi sys0, 0
+    ldi sys1, 1
+    ldi sys2, 1
+    sys 0x07
+    ldi sys0, 0
+    ldi sys1, 0xFFFFFFFE
+    sys 0x09
+    ldi r1, 1
+    ldi r2, 2
+    ldi r3, 3
+    ldi sys0, handler
+    sys 0x03
+    ldi r4, 4
+    ldi r5, 5
+    ldi r6, 6
+    hlt
+
+handler:
+    ldi sys0, 0x27
+    ldi sys1, 0x05
+    sys 0x0B
+    hlt
@@ -0,0 +1,25 @@
+# runs the regression programs, k32-as, k32-ld, k32-emu and k32-trace have to be on the PATH
+cd "$(dirname "$0")" || exit 1
+
+k32-as pmu.asm -o pmu.o && \
+k32-ld pmu.o -o pmu.bin --base 0x00000000 > /dev/null && \
+k32-emu pmu.bin --trace pmu.trace > /dev/null || exit 1
+if ! k32-trace pmu.trace | grep -q "0x00000026  0x00000004 "; then
+    echo "pmu.asm: counter 0 did not count the instructions after sys 0x07"
+    exit 1
+fi
+
+k32-as pmu_pending.asm -o pmu_pending.o && \
+k32-ld pmu_pending.o -o pmu_pending.bin --base 0x00000000 > /dev/null && \
+k32-emu pmu_pending.bin --trace pmu_pending.trace > /dev/null || exit 1
+if ! k32-trace pmu_pending.trace | grep -q "0x00000027  0x00000005 "; then
+    echo "pmu_pending.asm: the overflow interrupt was dropped before the handler was set"
+    exit 1
+fi
+
+if ! k32-as sections.asm -o sections.o > /dev/null; then
+    echo "sections.asm: sections with colliding name hashes were not told apart"
+    exit 1
+fi
+
+echo "All regression programs passed"
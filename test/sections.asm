@@ -0,0 +1,10 @@
+// .text.Aa and .text.BB hash the same, so sections have to be told apart by their full name
+.text
+start:
+    hlt
+
+.text.Aa
+    =0x00
+
+.text.BB
+    =0x00
@@ -0,0 +1,274 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+
+typedef float f32;
+typedef double f64;
+
+typedef size_t usize;
+
+/* must match live_stats_t in emulator/src/main.c */
+#define LIVE_STATS_MAGIC 0x4C32334B
+#define LIVE_STATS_VERSION 1
+
+typedef struct {
+	u32 magic;
+	u32 version;
+	volatile u32 sequence;
+	u32 pid;
+	u64 started_time;
+	u64 updated_time;
+	u64 retired;
+	u64 cycles;
+	u64 frames;
+	u64 interrupts;
+	f64 mips;
+	f64 interrupt_rate;
+	f64 idle_ratio;
+	u64 rss;
+	u32 halted;
+	u32 graphical;
+	char rom[64];
+} live_stats_t;
+
+#define SEGMENT_PREFIX "k32-emu."
+#define MAX_SEGMENTS 256
+#define READ_RETRIES 64
+
+typedef struct {
+	char name[64];
+	live_stats_t stats;
+	s32 alive;
+} segment_t;
+
+void print_help(s32 argc, char** argv) {
+	printf("Usage: %s [pid...] [options]\n", argv[0]);
+	printf("Flags:\n  [-d, --delay] <seconds> Refresh interval (default 1)\n");
+	printf("  [-n, --iterations] <count> Exit after this many refreshes\n");
+	printf("  [-1, --once] Print once and exit\n");
+	printf("  [--clean] Remove segments left behind by emulators that are no longer running\n");
+	printf("  [-h, --help] Print help message\n");
+}
+
+/* seqlock read: copy until the sequence is even and did not change while copying */
+s32 read_segment(const char* name, live_stats_t* out) {
+	char path[80];
+	snprintf(path, sizeof(path), "/%s", name);
+	s32 fd = shm_open(path, O_RDONLY, 0);
+	if (fd < 0) {
+		return 0;
+	}
+
+	void* p = mmap(NULL, sizeof(live_stats_t), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		return 0;
+	}
+
+	live_stats_t* shared = (live_stats_t*) p;
+	s32 ok = 0;
+	for (u32 i = 0; i < READ_RETRIES; ++i) {
+		u32 before = shared->sequence;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if ((before & 1) != 0) {
+			continue;
+		}
+
+		memcpy(out, (const void*) shared, sizeof(live_stats_t));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (shared->sequence == before) {
+			ok = out->magic == LIVE_STATS_MAGIC && out->version == LIVE_STATS_VERSION;
+			break;
+		}
+	}
+
+	munmap(p, sizeof(live_stats_t));
+	return ok;
+}
+
+u32 collect_segments(segment_t* segments, u32 max, char** pids, u32 pid_count) {
+	u32 count = 0;
+	if (pid_count != 0) {
+		for (u32 i = 0; i < pid_count && count < max; ++i) {
+			if (strlen(SEGMENT_PREFIX) + strlen(pids[i]) >= sizeof(segments[count].name)) {
+				printf("Not a k32-emu pid: %s\n", pids[i]);
+				continue;
+			}
+
+			snprintf(segments[count].name, sizeof(segments[count].name), SEGMENT_PREFIX "%s", pids[i]);
+			++count;
+		}
+	} else {
+		DIR* dir = opendir("/dev/shm");
+		if (dir == NULL) {
+			return 0;
+		}
+
+		struct dirent* entry;
+		while ((entry = readdir(dir)) != NULL && count < max) {
+			if (strncmp(entry->d_name, SEGMENT_PREFIX, strlen(SEGMENT_PREFIX)) != 0) {
+				continue;
+			}
+
+			/* k32-emu names its segments by pid, anything longer than the field is not one of them */
+			usize length = strlen(entry->d_name);
+			if (length >= sizeof(segments[count].name)) {
+				continue;
+			}
+
+			memcpy(segments[count].name, entry->d_name, length + 1);
+			++count;
+		}
+		closedir(dir);
+	}
+
+	u32 valid = 0;
+	for (u32 i = 0; i < count; ++i) {
+		if (!read_segment(segments[i].name, &segments[i].stats)) {
+			continue;
+		}
+
+		segments[i].alive = kill((pid_t) segments[i].stats.pid, 0) == 0 || errno == EPERM;
+		segments[valid++] = segments[i];
+	}
+
+	return valid;
+}
+
+void format_duration(u64 seconds, char* out, usize size) {
+	if (seconds >= 3600) {
+		snprintf(out, size, "%lluh%02llum", (unsigned long long) (seconds / 3600), (unsigned long long) ((seconds / 60) % 60));
+	} else {
+		snprintf(out, size, "%llum%02llus", (unsigned long long) (seconds / 60), (unsigned long long) (seconds % 60));
+	}
+}
+
+void print_segments(segment_t* segments, u32 count) {
+	u64 now = (u64) time(NULL);
+	printf("%-8s %-5s %10s %14s %9s %9s %6s %9s %8s  %s\n", "PID", "STATE", "MIPS", "RETIRED", "FRAMES", "INT/S", "IDLE", "RSS(MiB)", "UPTIME", "ROM");
+	for (u32 i = 0; i < count; ++i) {
+		live_stats_t* stats = &segments[i].stats;
+		const char* state = "run";
+		if (!segments[i].alive) {
+			state = "dead";
+		} else if (now > stats->updated_time + 2) {
+			state = "stall";
+		} else if (stats->halted) {
+			state = "halt";
+		} else if (stats->idle_ratio > 0.9) {
+			state = "idle";
+		}
+
+		char uptime[16];
+		format_duration((now > stats->started_time) ? now - stats->started_time : 0, uptime, sizeof(uptime));
+		printf("%-8u %-5s %10.2f %14llu %9llu %9.1f %5.1f%% %9.1f %8s  %s\n", stats->pid, state, stats->mips,
+			(unsigned long long) stats->retired, (unsigned long long) stats->frames, stats->interrupt_rate,
+			stats->idle_ratio * 100.0, (f64) stats->rss / (1024.0 * 1024.0), uptime, stats->rom);
+	}
+
+	if (count == 0) {
+		printf("No running k32-emu instances publishing live stats (start k32-emu with --live-stats)\n");
+	}
+}
+
+volatile sig_atomic_t interrupted = 0;
+void handle_signal(s32 signal) {
+	interrupted = 1;
+}
+
+s32 main(s32 argc, char** argv) {
+	u32 delay = 1;
+	s64 iterations = -1;
+	s32 clean = 0;
+	char* pids[MAX_SEGMENTS];
+	u32 pid_count = 0;
+
+	for (s32 i = 1; i < argc; ++i) {
+		if ((strcmp(argv[i], "-d") == 0 || strcmp(argv[i], "--delay") == 0) && i + 1 < argc) {
+			delay = (u32) strtoul(argv[i + 1], NULL, 10);
+			++i;
+		} else if ((strcmp(argv[i], "-n") == 0 || strcmp(argv[i], "--iterations") == 0) && i + 1 < argc) {
+			iterations = (s64) strtoll(argv[i + 1], NULL, 10);
+			++i;
+		} else if (strcmp(argv[i], "-1") == 0 || strcmp(argv[i], "--once") == 0) {
+			iterations = 1;
+		} else if (strcmp(argv[i], "--clean") == 0) {
+			clean = 1;
+		} else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+			print_help(argc, argv);
+			return 0;
+		} else if (argv[i][0] >= '0' && argv[i][0] <= '9' && pid_count < MAX_SEGMENTS) {
+			pids[pid_count++] = argv[i];
+		} else {
+			printf("Unknown argument (%d): %s\n", i, argv[i]);
+			print_help(argc, argv);
+			return 1;
+		}
+	}
+
+	segment_t* segments = (segment_t*) malloc(sizeof(segment_t) * MAX_SEGMENTS);
+	if (segments == NULL) {
+		printf("Failed to allocate memory\n");
+		return 1;
+	}
+
+	if (clean) {
+		u32 count = collect_segments(segments, MAX_SEGMENTS, pids, pid_count);
+		for (u32 i = 0; i < count; ++i) {
+			if (!segments[i].alive) {
+				char path[80];
+				snprintf(path, sizeof(path), "/%s", segments[i].name);
+				shm_unlink(path);
+				printf("Removed %s\n", segments[i].name);
+			}
+		}
+
+		free(segments);
+		return 0;
+	}
+
+	signal(SIGINT, handle_signal);
+	s32 interactive = isatty(STDOUT_FILENO) && iterations != 1;
+	while (!interrupted && iterations != 0) {
+		u32 count = collect_segments(segments, MAX_SEGMENTS, pids, pid_count);
+		if (interactive) {
+			printf("\x1b[H\x1b[2J");
+		}
+
+		print_segments(segments, count);
+		fflush(stdout);
+
+		if (iterations > 0) {
+			--iterations;
+		}
+
+		if (iterations != 0 && !interrupted) {
+			sleep(delay);
+		}
+	}
+
+	free(segments);
+	return 0;
+}
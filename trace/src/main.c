@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+
+typedef float f32;
+typedef double f64;
+
+typedef size_t usize;
+
+/* must match trace_record_t in emulator/src/main.c */
+#define TRACE_MAGIC 0x5432334B
+#define TRACE_VERSION 1
+
+typedef struct {
+	u64 retired;
+	u32 id;
+	u32 payload[4];
+	u32 dropped_before;
+} trace_record_t;
+
+typedef struct {
+	u32 id;
+	u64 count;
+	u64 first;
+	u64 last;
+} trace_summary_t;
+
+#define READ_BATCH 4096
+
+void print_help(s32 argc, char** argv) {
+	printf("Usage: %s <trace file> [options]\n", argv[0]);
+	printf("Flags:\n  [-i, --id] <id> Only print tracepoints with this id\n");
+	printf("  [-s, --summary] Print a count per tracepoint id instead of every record\n");
+	printf("  [-h, --help] Print help message\n");
+}
+
+trace_summary_t* find_summary(trace_summary_t** summaries, usize* count, usize* capacity, u32 id) {
+	for (usize i = 0; i < *count; ++i) {
+		if ((*summaries)[i].id == id) {
+			return &(*summaries)[i];
+		}
+	}
+
+	if (*count == *capacity) {
+		usize grown = (*capacity == 0) ? 64 : *capacity * 2;
+		void* p = realloc(*summaries, grown * sizeof(trace_summary_t));
+		if (p == NULL) {
+			return NULL;
+		}
+
+		*summaries = (trace_summary_t*) p;
+		*capacity = grown;
+	}
+
+	trace_summary_t* summary = &(*summaries)[(*count)++];
+	summary->id = id;
+	summary->count = 0;
+	summary->first = 0;
+	summary->last = 0;
+	return summary;
+}
+
+int main(s32 argc, char** argv) {
+	if (argc < 2) {
+		print_help(argc, argv);
+		return 1;
+	}
+
+	char* path = NULL;
+	s32 filter = 0;
+	u32 filter_id = 0;
+	s32 summary = 0;
+	for (s32 i = 1; i < argc; ++i) {
+		if ((strcmp(argv[i], "-i") == 0 || strcmp(argv[i], "--id") == 0) && i + 1 < argc) {
+			filter = 1;
+			filter_id = (u32) strtoul(argv[i + 1], NULL, 0);
+			++i;
+		} else if (strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "--summary") == 0) {
+			summary = 1;
+		} else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+			print_help(argc, argv);
+			return 0;
+		} else if (path == NULL && argv[i][0] != '-') {
+			path = argv[i];
+		} else {
+			printf("Unknown argument (%d): %s\n", i, argv[i]);
+			print_help(argc, argv);
+			return 1;
+		}
+	}
+
+	if (path == NULL) {
+		print_help(argc, argv);
+		return 1;
+	}
+
+	FILE* file = fopen(path, "rb");
+	if (file == NULL) {
+		printf("Failed to open trace file: %s\n", path);
+		return 1;
+	}
+
+	u32 header[4];
+	if (fread(header, sizeof(header), 1, file) != 1 || header[0] != TRACE_MAGIC) {
+		printf("Not a k32 trace file: %s\n", path);
+		fclose(file);
+		return 1;
+	}
+
+	if (header[1] != TRACE_VERSION || header[2] != sizeof(trace_record_t)) {
+		printf("Unsupported trace version %u (record size %u)\n", header[1], header[2]);
+		fclose(file);
+		return 1;
+	}
+
+	trace_record_t* records = (trace_record_t*) malloc(READ_BATCH * sizeof(trace_record_t));
+	if (records == NULL) {
+		printf("Failed to allocate memory\n");
+		fclose(file);
+		return 1;
+	}
+
+	trace_summary_t* summaries = NULL;
+	usize summary_count = 0;
+	usize summary_capacity = 0;
+	u64 total = 0;
+	u64 dropped = 0;
+	usize read = 0;
+	while ((read = fread(records, sizeof(trace_record_t), READ_BATCH, file)) != 0) {
+		for (usize i = 0; i < read; ++i) {
+			trace_record_t* record = &records[i];
+			++total;
+			dropped += record->dropped_before;
+			if (summary) {
+				trace_summary_t* entry = find_summary(&summaries, &summary_count, &summary_capacity, record->id);
+				if (entry == NULL) {
+					printf("Failed to allocate memory\n");
+					return 1;
+				}
+
+				if (entry->count == 0) {
+					entry->first = record->retired;
+				}
+				entry->last = record->retired;
+				++entry->count;
+				continue;
+			}
+
+			if (record->dropped_before != 0) {
+				printf("[%u records dropped]\n", record->dropped_before);
+			}
+
+			if (filter && record->id != filter_id) {
+				continue;
+			}
+
+			printf("%14llu  0x%08x  0x%08x 0x%08x 0x%08x 0x%08x\n", (unsigned long long) record->retired, record->id,
+				record->payload[0], record->payload[1], record->payload[2], record->payload[3]);
+		}
+	}
+
+	if (summary) {
+		printf("%-10s %12s %14s %14s\n", "id", "count", "first", "last");
+		for (usize i = 0; i < summary_count; ++i) {
+			trace_summary_t* entry = &summaries[i];
+			if (filter && entry->id != filter_id) {
+				continue;
+			}
+
+			printf("0x%08x %12llu %14llu %14llu\n", entry->id, (unsigned long long) entry->count,
+				(unsigned long long) entry->first, (unsigned long long) entry->last);
+		}
+	}
+
+	/* the header total also covers records dropped after the last one written */
+	if (header[3] > dropped) {
+		dropped = header[3];
+	}
+	printf("%llu records, %llu dropped\n", (unsigned long long) total, (unsigned long long) dropped);
+
+	free(summaries);
+	free(records);
+	fclose(file);
+	return 0;
+}